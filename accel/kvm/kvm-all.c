@@ -482,34 +482,38 @@ static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
     return kvm_set_user_memory_region(kml, mem, false);
 }
 
-static int kvm_section_update_flags(KVMMemoryListener *kml,
-                                    MemoryRegionSection *section)
+/* Called with KVMMemoryListener.slots_lock held */
+static int kvm_section_update_flags_locked(KVMMemoryListener *kml,
+                                           MemoryRegionSection *section)
 {
     hwaddr start_addr, size, slot_size;
     KVMSlot *mem;
     int ret = 0;
 
     size = kvm_align_section(section, &start_addr);
-    if (!size) {
-        return 0;
-    }
-
-    kvm_slots_lock();
 
     while (size && !ret) {
         slot_size = MIN(kvm_max_slot_size, size);
         mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
         if (!mem) {
             /* We don't have a slot if we want to trap every access. */
-            goto out;
+            break;
         }
 
         ret = kvm_slot_update_flags(kml, mem, section->mr);
         start_addr += slot_size;
         size -= slot_size;
     }
+    return ret;
+}
 
-out:
+static int kvm_section_update_flags(KVMMemoryListener *kml,
+                                    MemoryRegionSection *section)
+{
+    int ret;
+
+    kvm_slots_lock();
+    ret = kvm_section_update_flags_locked(kml, section);
     kvm_slots_unlock();
     return ret;
 }
@@ -1487,93 +1491,128 @@ static int kvm_dirty_ring_init(KVMState *s)
     return 0;
 }
 
-static void kvm_region_add(MemoryListener *listener,
-                           MemoryRegionSection *section)
-{
-    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
-    KVMMemoryUpdate *update;
-
-    update = g_new0(KVMMemoryUpdate, 1);
-    update->section = *section;
-
-    QSIMPLEQ_INSERT_TAIL(&kml->transaction_add, update, next);
-}
-
-static void kvm_region_del(MemoryListener *listener,
-                           MemoryRegionSection *section)
+/*
+ * Returns true if the sections @old and @new map the same RAM at the same
+ * place, so that their memslots can be kept and only need new flags.
+ * KVM_MEM_READONLY cannot be changed in place, and a slot that stops dirty
+ * logging goes through removal so that its dirty bitmap is synced first.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static bool kvm_section_unchanged(KVMMemoryListener *kml,
+                                  MemoryRegionSection *old,
+                                  MemoryRegionSection *new)
 {
-    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
-    KVMMemoryUpdate *update;
+    hwaddr start_addr, size, slot_size;
+    int flags = kvm_mem_flags(new->mr);
+    KVMSlot *mem;
 
-    update = g_new0(KVMMemoryUpdate, 1);
-    update->section = *section;
+    if (old->mr != new->mr || !memory_region_is_ram(new->mr) ||
+        old->offset_within_address_space != new->offset_within_address_space ||
+        old->offset_within_region != new->offset_within_region ||
+        int128_ne(old->size, new->size)) {
+        return false;
+    }
 
-    QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
+    size = kvm_align_section(new, &start_addr);
+    while (size) {
+        slot_size = MIN(kvm_max_slot_size, size);
+        mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
+        if (!mem || ((mem->old_flags ^ flags) & KVM_MEM_READONLY) ||
+            (mem->old_flags & ~flags & KVM_MEM_LOG_DIRTY_PAGES)) {
+            return false;
+        }
+        start_addr += slot_size;
+        size -= slot_size;
+    }
+    return true;
 }
 
-static void kvm_region_commit(MemoryListener *listener)
+static void kvm_region_update(MemoryListener *listener,
+                              MemoryRegionSection *del, unsigned nr_del,
+                              MemoryRegionSection *add, unsigned nr_add)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
                                           listener);
-    KVMMemoryUpdate *u1, *u2;
+    g_autofree bool *keep_del = g_new0(bool, nr_del);
+    g_autofree bool *keep_add = g_new0(bool, nr_add);
     bool need_inhibit = false;
+    unsigned i, j;
 
-    if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
-        QSIMPLEQ_EMPTY(&kml->transaction_del)) {
-        return;
+    kvm_slots_lock();
+
+    /*
+     * A section that is removed and added back unchanged, e.g. because
+     * an attribute that KVM does not care about changed, keeps its memslots.
+     *
+     * The arrays are sorted by address, so it's easy to find such pairs.
+     */
+    for (i = j = 0; i < nr_del && j < nr_add; ) {
+        if (del[i].offset_within_address_space <
+            add[j].offset_within_address_space) {
+            i++;
+        } else if (del[i].offset_within_address_space >
+                   add[j].offset_within_address_space) {
+            j++;
+        } else {
+            keep_del[i] = keep_add[j] =
+                kvm_section_unchanged(kml, &del[i], &add[j]);
+            i++;
+            j++;
+        }
     }
 
     /*
      * We have to be careful when regions to add overlap with ranges to remove.
      * We have to simulate atomic KVM memslot updates by making sure no ioctl()
      * is currently active.
-     *
-     * The lists are order by addresses, so it's easy to find overlaps.
      */
-    u1 = QSIMPLEQ_FIRST(&kml->transaction_del);
-    u2 = QSIMPLEQ_FIRST(&kml->transaction_add);
-    while (u1 && u2) {
+    for (i = j = 0; i < nr_del && j < nr_add; ) {
         Range r1, r2;
 
-        range_init_nofail(&r1, u1->section.offset_within_address_space,
-                          int128_get64(u1->section.size));
-        range_init_nofail(&r2, u2->section.offset_within_address_space,
-                          int128_get64(u2->section.size));
+        if (keep_del[i]) {
+            i++;
+            continue;
+        }
+        if (keep_add[j]) {
+            j++;
+            continue;
+        }
+
+        range_init_nofail(&r1, del[i].offset_within_address_space,
+                          int128_get64(del[i].size));
+        range_init_nofail(&r2, add[j].offset_within_address_space,
+                          int128_get64(add[j].size));
 
         if (range_overlaps_range(&r1, &r2)) {
             need_inhibit = true;
             break;
         }
         if (range_lob(&r1) < range_lob(&r2)) {
-            u1 = QSIMPLEQ_NEXT(u1, next);
+            i++;
         } else {
-            u2 = QSIMPLEQ_NEXT(u2, next);
+            j++;
         }
     }
 
-    kvm_slots_lock();
     if (need_inhibit) {
         accel_ioctl_inhibit_begin();
     }
 
     /* Remove all memslots before adding the new ones. */
-    while (!QSIMPLEQ_EMPTY(&kml->transaction_del)) {
-        u1 = QSIMPLEQ_FIRST(&kml->transaction_del);
-        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_del, next);
-
-        kvm_set_phys_mem(kml, &u1->section, false);
-        memory_region_unref(u1->section.mr);
-
-        g_free(u1);
+    for (i = 0; i < nr_del; i++) {
+        if (!keep_del[i]) {
+            kvm_set_phys_mem(kml, &del[i], false);
+            memory_region_unref(del[i].mr);
+        }
     }
-    while (!QSIMPLEQ_EMPTY(&kml->transaction_add)) {
-        u1 = QSIMPLEQ_FIRST(&kml->transaction_add);
-        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_add, next);
-
-        memory_region_ref(u1->section.mr);
-        kvm_set_phys_mem(kml, &u1->section, true);
-
-        g_free(u1);
+    for (j = 0; j < nr_add; j++) {
+        if (keep_add[j]) {
+            kvm_section_update_flags_locked(kml, &add[j]);
+        } else {
+            memory_region_ref(add[j].mr);
+            kvm_set_phys_mem(kml, &add[j], true);
+        }
     }
 
     if (need_inhibit) {
@@ -1729,12 +1768,7 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
         kml->slots[i].slot = i;
     }
 
-    QSIMPLEQ_INIT(&kml->transaction_add);
-    QSIMPLEQ_INIT(&kml->transaction_del);
-
-    kml->listener.region_add = kvm_region_add;
-    kml->listener.region_del = kvm_region_del;
-    kml->listener.commit = kvm_region_commit;
+    kml->listener.region_update = kvm_region_update;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
     kml->listener.priority = MEMORY_LISTENER_PRIORITY_ACCEL;
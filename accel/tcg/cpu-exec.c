@@ -484,6 +484,11 @@ cpu_tb_exec(CPUState *cpu, TranslationBlock *itb, int *tb_exit)
                          last_tb->tc.ptr, pc, lookup_symbol(pc));
             }
         }
+        if (unlikely(*tb_exit == TB_EXIT_REQUESTED &&
+                     qatomic_read(&cpu->tb_profile_pending))) {
+            qatomic_set(&cpu->tb_profile_pending, false);
+            tb_profile_record(log_pc(cpu, last_tb));
+        }
     }
 
     /*
@@ -884,6 +889,8 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
     /* Finally, check if we need to exit to the main loop.  */
     if (unlikely(qatomic_read(&cpu->exit_request)) || icount_exit_request(cpu)) {
         qatomic_set(&cpu->exit_request, 0);
+        /* A profiler kick that did not stop a TB leaves no sample. */
+        qatomic_set(&cpu->tb_profile_pending, false);
         if (cpu->exception_index == -1) {
             cpu->exception_index = EXCP_INTERRUPT;
         }
@@ -1043,6 +1050,13 @@ int cpu_exec(CPUState *cpu)
     /* replay_interrupt may need current_cpu */
     current_cpu = cpu;
 
+    /*
+     * The exit request that went with a pending profiler kick may have
+     * been consumed outside of cpu_exec (e.g. by the vCPU thread loop);
+     * re-arm the profiler so that this vCPU is sampled again.
+     */
+    qatomic_set(&cpu->tb_profile_pending, false);
+
     if (cpu_handle_halt(cpu)) {
         return EXCP_HALTED;
     }
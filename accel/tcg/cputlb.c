@@ -237,7 +237,8 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
-    desc->vindex = 0;
+    desc->last_miss_page = -1;
+    memset(desc->vindex, 0, sizeof(desc->vindex));
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -451,17 +452,38 @@ static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry, vaddr page)
     return tlb_flush_entry_mask_locked(tlb_entry, page, -1);
 }
 
-/* Called with tlb_c.lock held */
+/*
+ * Return the index of the first way of the victim tlb set for @page.
+ *
+ * The set is selected by the low bits of the virtual page number, which
+ * are also the low bits of the main tlb index.  Thus an entry evicted
+ * from the main tlb for @page, or swapped out by victim_tlb_hit for
+ * @page, always belongs to the same set as @page itself.
+ */
+static inline size_t vtlb_set_base(vaddr page)
+{
+    QEMU_BUILD_BUG_ON(CPU_VTLB_SETS_BITS > CPU_TLB_DYN_MIN_BITS);
+    QEMU_BUILD_BUG_ON(CPU_VTLB_WAYS & (CPU_VTLB_WAYS - 1));
+
+    return ((page >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1)) * CPU_VTLB_WAYS;
+}
+
+/*
+ * Called with tlb_c.lock held.
+ * Any @mask accepted by tlb_flush_range_locked covers at least the main
+ * tlb index bits, and thus the victim set bits, so only one set is searched.
+ */
 static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
                                             vaddr page,
                                             vaddr mask)
 {
     CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
+    size_t base = vtlb_set_base(page);
     int k;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
-        if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
+    for (k = 0; k < CPU_VTLB_WAYS; k++) {
+        if (tlb_flush_entry_mask_locked(&d->vtable[base + k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
     }
@@ -492,6 +514,127 @@ static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
     }
 }
 
+typedef struct {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} TLBFlushRangeData;
+
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d);
+
+/**
+ * tlb_flush_batch_async_work:
+ * @cpu: cpu on which to flush
+ * @data: unused
+ *
+ * Perform all of the page flushes queued for @cpu by
+ * tlb_flush_page_batch_add since the last time this ran.
+ */
+static void tlb_flush_batch_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    CPUTLBFlushRange pending[CPU_TLB_FLUSH_BATCH_SIZE];
+    uint16_t full;
+    unsigned i, n;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&c->lock);
+    full = c->pending_full;
+    n = c->pending_count;
+    memcpy(pending, c->pending, n * sizeof(CPUTLBFlushRange));
+    c->pending_full = 0;
+    c->pending_count = 0;
+    c->pending_scheduled = false;
+    qemu_spin_unlock(&c->lock);
+
+    tlb_debug("batch: %u ranges, full mmu_map:0x%x\n", n, full);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        TLBFlushRangeData d = {
+            .addr = pending[i].addr,
+            .len = pending[i].len,
+            .idxmap = pending[i].idxmap & ~full,
+            .bits = TARGET_LONG_BITS,
+        };
+        if (d.idxmap) {
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+
+    qatomic_set(&c->batch_flush_count, c->batch_flush_count + 1);
+}
+
+/**
+ * tlb_flush_page_batch_add:
+ * @cpu: cpu on which to flush, other than the current cpu
+ * @addr: page of virtual address to flush
+ * @idxmap: set of mmu_idx to flush
+ *
+ * Queue a flush of one page for @cpu.  Rather than queuing one work
+ * item per page, adjacent pages are merged into ranges, and all of the
+ * ranges are flushed by a single work item.  If too many discontiguous
+ * ranges accumulate, flush the affected mmu_idx entirely.
+ */
+static void tlb_flush_page_batch_add(CPUState *cpu, vaddr addr,
+                                     uint16_t idxmap)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    bool schedule;
+    unsigned i;
+
+    qemu_spin_lock(&c->lock);
+
+    qatomic_set(&c->batch_page_count, c->batch_page_count + 1);
+    idxmap &= ~c->pending_full;
+    for (i = 0; idxmap && i < c->pending_count; i++) {
+        CPUTLBFlushRange *r = &c->pending[i];
+
+        if (r->idxmap != idxmap) {
+            continue;
+        }
+        if (addr >= r->addr && addr - r->addr <= r->len) {
+            /* Already covered, or extends the range upward.  */
+            r->len = MAX(r->len, addr - r->addr + TARGET_PAGE_SIZE);
+            idxmap = 0;
+        } else if (addr + TARGET_PAGE_SIZE == r->addr) {
+            r->addr = addr;
+            r->len += TARGET_PAGE_SIZE;
+            idxmap = 0;
+        }
+    }
+
+    if (!idxmap) {
+        qatomic_set(&c->batch_merge_count, c->batch_merge_count + 1);
+    } else if (c->pending_count < CPU_TLB_FLUSH_BATCH_SIZE) {
+        c->pending[c->pending_count++] = (CPUTLBFlushRange) {
+            .addr = addr,
+            .len = TARGET_PAGE_SIZE,
+            .idxmap = idxmap,
+        };
+    } else {
+        for (i = 0; i < c->pending_count; i++) {
+            idxmap |= c->pending[i].idxmap;
+        }
+        c->pending_full |= idxmap;
+        c->pending_count = 0;
+        qatomic_set(&c->batch_overflow_count, c->batch_overflow_count + 1);
+    }
+
+    schedule = !c->pending_scheduled;
+    c->pending_scheduled = true;
+    qemu_spin_unlock(&c->lock);
+
+    if (schedule) {
+        async_run_on_cpu(cpu, tlb_flush_batch_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
 /**
  * tlb_flush_page_by_mmuidx_async_0:
  * @cpu: cpu on which to flush
@@ -580,22 +723,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_page_batch_add(cpu, addr, idxmap);
     }
 }
 
@@ -607,32 +736,16 @@ void tlb_flush_page(CPUState *cpu, vaddr addr)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, vaddr addr,
                                        uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_batch_add(dst_cpu, addr, idxmap);
         }
     }
 
@@ -648,36 +761,31 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               uint16_t idxmap)
 {
+    CPUState *dst_cpu;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_batch_add(dst_cpu, addr, idxmap);
+        }
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -740,13 +848,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -1052,9 +1153,11 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        size_t base = vtlb_set_base(addr);
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
+        for (k = 0; k < CPU_VTLB_WAYS; k++) {
+            tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[base + k],
+                                  addr);
         }
     }
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
@@ -1217,9 +1320,13 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        size_t set = vtlb_set_base(addr_page) / CPU_VTLB_WAYS;
+        unsigned way = desc->vindex[set];
+        unsigned vidx = set * CPU_VTLB_WAYS + way;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
+        desc->vindex[set] = (way + 1) & (CPU_VTLB_WAYS - 1);
+
         /* Evict the old entry into the victim tlb.  */
         copy_tlb_helper_locked(tv, te);
         desc->vfulltlb[vidx] = desc->fulltlb[index];
@@ -1354,15 +1461,15 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
     }
 }
 
-/* Return true if ADDR is present in the victim tlb, and has been copied
-   back to the main tlb.  */
-static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
-                           MMUAccessType access_type, vaddr page)
+/* Return true if PAGE is present in its set of the victim tlb, and has
+   been swapped with entry INDEX of the main tlb.  */
+static bool victim_tlb_swap(CPUState *cpu, size_t mmu_idx, size_t index,
+                            MMUAccessType access_type, vaddr page)
 {
+    size_t base = vtlb_set_base(page);
     size_t vidx;
 
-    assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = base; vidx < base + CPU_VTLB_WAYS; ++vidx) {
         CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
@@ -1386,6 +1493,49 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
     return false;
 }
 
+/* Return true if ADDR is present in the victim tlb, and has been copied
+   back to the main tlb.  */
+static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
+                           MMUAccessType access_type, vaddr page)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    bool hit;
+
+    assert_cpu_is_self(cpu);
+
+    hit = victim_tlb_swap(cpu, mmu_idx, index, access_type, page);
+    if (hit) {
+        qatomic_set(&cpu->neg.tlb.c.vtlb_hit_count,
+                    cpu->neg.tlb.c.vtlb_hit_count + 1);
+    }
+
+    /*
+     * On a sequential stream of misses, e.g. a guest memcpy walking
+     * upward through a buffer, move the following page forward from the
+     * victim tlb as well, so that the next access hits the fast path.
+     * Only a miss on exactly last_miss_page + TARGET_PAGE_SIZE triggers
+     * the prefetch: a repeated miss on the same page, a downward walk or
+     * a stride of more than one page does not.  last_miss_page is updated
+     * on every miss, whether or not the victim tlb hit.  We do not
+     * speculatively call tlb_fill, as a page table walk may have guest
+     * visible side effects such as setting accessed bits.
+     */
+    if (page == desc->last_miss_page + TARGET_PAGE_SIZE) {
+        vaddr next = page + TARGET_PAGE_SIZE;
+        CPUTLBEntry *entry = tlb_entry(cpu, mmu_idx, next);
+
+        if (!tlb_hit_page(tlb_read_idx(entry, access_type), next) &&
+            victim_tlb_swap(cpu, mmu_idx, tlb_index(cpu, mmu_idx, next),
+                            access_type, next)) {
+            qatomic_set(&cpu->neg.tlb.c.vtlb_prefetch_count,
+                        cpu->neg.tlb.c.vtlb_prefetch_count + 1);
+        }
+    }
+    desc->last_miss_page = page;
+
+    return hit;
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
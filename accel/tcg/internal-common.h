@@ -23,4 +23,11 @@ static inline bool cpu_in_serial_context(CPUState *cs)
     return !(cs->tcg_cflags & CF_PARALLEL) || cpu_in_exclusive_context(cs);
 }
 
+void tb_profile_start(unsigned interval_us, bool reset);
+void tb_profile_stop(void);
+void tb_profile_record(vaddr pc);
+void tb_profile_dump(GString *buf);
+
+void tcg_stats_init(void);
+
 #endif
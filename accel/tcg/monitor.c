@@ -12,9 +12,13 @@
 #include "qapi/error.h"
 #include "qapi/type-helpers.h"
 #include "qapi/qapi-commands-machine.h"
+#include "qapi/qapi-types-stats.h"
+#include "monitor/hmp.h"
 #include "monitor/monitor.h"
+#include "qapi/qmp/qdict.h"
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/stats.h"
 #include "sysemu/tcg.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
@@ -126,6 +130,37 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tlb_vtlb_counts(size_t *phit, size_t *pprefetch)
+{
+    CPUState *cpu;
+    size_t hit = 0, prefetch = 0;
+
+    CPU_FOREACH(cpu) {
+        hit += qatomic_read(&cpu->neg.tlb.c.vtlb_hit_count);
+        prefetch += qatomic_read(&cpu->neg.tlb.c.vtlb_prefetch_count);
+    }
+    *phit = hit;
+    *pprefetch = prefetch;
+}
+
+static void tlb_batch_counts(size_t *pbatch, size_t *ppage,
+                             size_t *pmerge, size_t *poverflow)
+{
+    CPUState *cpu;
+    size_t batch = 0, page = 0, merge = 0, overflow = 0;
+
+    CPU_FOREACH(cpu) {
+        batch += qatomic_read(&cpu->neg.tlb.c.batch_flush_count);
+        page += qatomic_read(&cpu->neg.tlb.c.batch_page_count);
+        merge += qatomic_read(&cpu->neg.tlb.c.batch_merge_count);
+        overflow += qatomic_read(&cpu->neg.tlb.c.batch_overflow_count);
+    }
+    *pbatch = batch;
+    *ppage = page;
+    *pmerge = merge;
+    *poverflow = overflow;
+}
+
 static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -141,6 +176,84 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+/*
+ * The per-vCPU tlb counters, as reported by query-stats with the "tcg"
+ * provider.  All of them are cumulative.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+} tlb_stats[] = {
+    { "tlb-full-flushes", offsetof(CPUTLBCommon, full_flush_count) },
+    { "tlb-partial-flushes", offsetof(CPUTLBCommon, part_flush_count) },
+    { "tlb-elided-flushes", offsetof(CPUTLBCommon, elide_flush_count) },
+    { "tlb-batched-flushes", offsetof(CPUTLBCommon, batch_flush_count) },
+    { "tlb-batched-pages", offsetof(CPUTLBCommon, batch_page_count) },
+    { "tlb-batched-merges", offsetof(CPUTLBCommon, batch_merge_count) },
+    { "tlb-batch-overflows", offsetof(CPUTLBCommon, batch_overflow_count) },
+    { "tlb-victim-hits", offsetof(CPUTLBCommon, vtlb_hit_count) },
+    { "tlb-prefetches", offsetof(CPUTLBCommon, vtlb_prefetch_count) },
+};
+
+static void tcg_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets,
+                               Error **errp)
+{
+    CPUState *cpu;
+    int i;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        StatsList *stats_list = NULL;
+        const char *path = cpu->parent_obj.canonical_path;
+
+        if (!apply_str_list_filter(path, targets)) {
+            continue;
+        }
+        for (i = ARRAY_SIZE(tlb_stats) - 1; i >= 0; i--) {
+            size_t *counter = (void *)&cpu->neg.tlb.c + tlb_stats[i].offset;
+            Stats *stats;
+
+            if (!apply_str_list_filter(tlb_stats[i].name, names)) {
+                continue;
+            }
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(tlb_stats[i].name);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QNUM;
+            stats->value->u.scalar = qatomic_read(counter);
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG, path, stats_list);
+        }
+    }
+}
+
+static void tcg_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(tlb_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(tlb_stats[i].name);
+        value->type = STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU, list);
+}
+
+void tcg_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_TCG, tcg_query_stats_cb,
+                        tcg_query_stats_schemas_cb);
+}
+
 static void tcg_dump_info(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
@@ -151,6 +264,8 @@ static void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t vtlb_hit, vtlb_prefetch;
+    size_t batch_flush, batch_page, batch_merge, batch_overflow;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -196,6 +311,16 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+
+    tlb_batch_counts(&batch_flush, &batch_page, &batch_merge, &batch_overflow);
+    g_string_append_printf(buf, "TLB batched flushes %zu\n", batch_flush);
+    g_string_append_printf(buf, "TLB batched pages   %zu (%zu merged)\n",
+                           batch_page, batch_merge);
+    g_string_append_printf(buf, "TLB batch overflows %zu\n", batch_overflow);
+
+    tlb_vtlb_counts(&vtlb_hit, &vtlb_prefetch);
+    g_string_append_printf(buf, "TLB victim hits     %zu\n", vtlb_hit);
+    g_string_append_printf(buf, "TLB prefetches      %zu\n", vtlb_prefetch);
     tcg_dump_info(buf);
 }
 
@@ -235,10 +360,59 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+void qmp_x_tcg_profile(bool enable, bool has_interval, uint32_t interval,
+                       bool has_reset, bool reset, Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return;
+    }
+
+    if (!enable) {
+        tb_profile_stop();
+        return;
+    }
+    if (has_interval && interval < 10) {
+        error_setg(errp, "TB profile interval must be at least 10 us");
+        return;
+    }
+    tb_profile_start(interval, !has_reset || reset);
+}
+
+HumanReadableText *qmp_x_query_tcg_profile(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return NULL;
+    }
+
+    tb_profile_dump(buf);
+
+    return human_readable_text_from_str(buf);
+}
+
+void hmp_tcg_profile(Monitor *mon, const QDict *qdict)
+{
+    bool enable = qdict_get_bool(qdict, "enable");
+    bool has_interval = qdict_haskey(qdict, "interval");
+    int64_t interval = qdict_get_try_int(qdict, "interval", 0);
+    Error *err = NULL;
+
+    if (has_interval && (interval < 0 || interval > UINT32_MAX)) {
+        monitor_printf(mon, "invalid interval %" PRId64 "\n", interval);
+        return;
+    }
+    qmp_x_tcg_profile(enable, has_interval, interval, false, false, &err);
+    hmp_handle_error(mon, err);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
     monitor_register_hmp_info_hrt("opcount", qmp_x_query_opcount);
+    monitor_register_hmp_info_hrt("tcg-profile", qmp_x_query_tcg_profile);
 }
 
 type_init(hmp_tcg_register);
@@ -0,0 +1,217 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Sampling profiler for translated code.
+ *
+ * A sampler thread periodically asks every vCPU to leave its chain of
+ * translation blocks, as cpu_exit() does.  The vCPU then records the
+ * guest PC of the TB it was about to execute.  Each sample stands for
+ * one sampling interval of host time.  A vCPU that has not picked up its
+ * previous request by the next interval spent that time outside translated
+ * code, e.g. halted or in a helper, and is counted as such.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "hw/core/cpu.h"
+#include "disas/disas.h"
+#include "tcg/debuginfo.h"
+#include "internal-common.h"
+
+#define TB_PROFILE_DEFAULT_INTERVAL_US  1000
+
+typedef struct TBProfileEntry {
+    vaddr pc;           /* key, first for g_int64_hash */
+    uint64_t count;
+} TBProfileEntry;
+
+static struct {
+    QemuMutex lock;
+    QemuThread thread;
+    /* Guest PC -> TBProfileEntry, protected by @lock. */
+    GHashTable *samples;
+    uint64_t nb_samples;
+    uint64_t nb_idle;
+    unsigned interval_us;
+    bool running;
+    bool stop;
+} tb_prof;
+
+static void __attribute__((constructor)) tb_profile_init(void)
+{
+    qemu_mutex_init(&tb_prof.lock);
+}
+
+void tb_profile_record(vaddr pc)
+{
+    TBProfileEntry *e;
+
+    QEMU_BUILD_BUG_ON(sizeof(vaddr) != sizeof(gint64));
+
+    qemu_mutex_lock(&tb_prof.lock);
+    if (tb_prof.samples) {
+        e = g_hash_table_lookup(tb_prof.samples, &pc);
+        if (!e) {
+            e = g_new0(TBProfileEntry, 1);
+            e->pc = pc;
+            g_hash_table_add(tb_prof.samples, e);
+        }
+        e->count++;
+        tb_prof.nb_samples++;
+    }
+    qemu_mutex_unlock(&tb_prof.lock);
+}
+
+static void *tb_profile_thread(void *opaque)
+{
+    rcu_register_thread();
+
+    while (!qatomic_read(&tb_prof.stop)) {
+        unsigned idle = 0;
+        CPUState *cpu;
+
+        g_usleep(qatomic_read(&tb_prof.interval_us));
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            CPU_FOREACH(cpu) {
+                if (qatomic_xchg(&cpu->tb_profile_pending, true)) {
+                    idle++;
+                } else {
+                    cpu_exit(cpu);
+                }
+            }
+        }
+        if (idle) {
+            qemu_mutex_lock(&tb_prof.lock);
+            tb_prof.nb_idle += idle;
+            qemu_mutex_unlock(&tb_prof.lock);
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * Start sampling, or if sampling is already running, switch to the new
+ * interval and optionally discard the samples taken so far.
+ */
+void tb_profile_start(unsigned interval_us, bool reset)
+{
+    qemu_mutex_lock(&tb_prof.lock);
+    if (!tb_prof.samples) {
+        tb_prof.samples = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                g_free, NULL);
+    } else if (reset) {
+        g_hash_table_remove_all(tb_prof.samples);
+    }
+    if (reset) {
+        tb_prof.nb_samples = 0;
+        tb_prof.nb_idle = 0;
+    }
+    qemu_mutex_unlock(&tb_prof.lock);
+
+    qatomic_set(&tb_prof.interval_us,
+                interval_us ? : TB_PROFILE_DEFAULT_INTERVAL_US);
+    if (tb_prof.running) {
+        return;
+    }
+    tb_prof.stop = false;
+    tb_prof.running = true;
+    qemu_thread_create(&tb_prof.thread, "tcg-profile", tb_profile_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+void tb_profile_stop(void)
+{
+    CPUState *cpu;
+
+    if (!tb_prof.running) {
+        return;
+    }
+    qatomic_set(&tb_prof.stop, true);
+    qemu_thread_join(&tb_prof.thread);
+    tb_prof.running = false;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        CPU_FOREACH(cpu) {
+            qatomic_set(&cpu->tb_profile_pending, false);
+        }
+    }
+}
+
+static int tb_profile_cmp(const void *a, const void *b)
+{
+    const TBProfileEntry *ea = a, *eb = b;
+
+    if (ea->count != eb->count) {
+        return ea->count > eb->count ? -1 : 1;
+    }
+    return ea->pc < eb->pc ? -1 : ea->pc > eb->pc;
+}
+
+/*
+ * Emit the samples in the collapsed stack format understood by
+ * flamegraph.pl, most frequent first: "symbol;pc count", or just
+ * "pc count" for guest code without symbols.
+ */
+void tb_profile_dump(GString *buf)
+{
+    GHashTableIter iter;
+    gpointer key;
+    TBProfileEntry *entries;
+    struct debuginfo_query *q;
+    uint64_t nb_samples, nb_idle;
+    size_t i, n = 0;
+
+    qemu_mutex_lock(&tb_prof.lock);
+    nb_samples = tb_prof.nb_samples;
+    nb_idle = tb_prof.nb_idle;
+    entries = g_new(TBProfileEntry,
+                    tb_prof.samples ? g_hash_table_size(tb_prof.samples) : 0);
+    if (tb_prof.samples) {
+        g_hash_table_iter_init(&iter, tb_prof.samples);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            entries[n++] = *(TBProfileEntry *)key;
+        }
+    }
+    qemu_mutex_unlock(&tb_prof.lock);
+
+    g_string_append_printf(buf, "# TB profile: %s, interval %u us, "
+                           "%" PRIu64 " samples, %" PRIu64 " outside TBs\n",
+                           tb_prof.running ? "running" : "stopped",
+                           tb_prof.interval_us, nb_samples, nb_idle);
+
+    qsort(entries, n, sizeof(*entries), tb_profile_cmp);
+
+    q = g_new0(struct debuginfo_query, n);
+    for (i = 0; i < n; i++) {
+        q[i].address = entries[i].pc;
+        q[i].flags = DEBUGINFO_SYMBOL;
+    }
+
+    debuginfo_lock();
+    debuginfo_query(q, n);
+    for (i = 0; i < n; i++) {
+        const char *sym = q[i].symbol;
+
+        if (!sym) {
+            sym = lookup_symbol(entries[i].pc);
+        }
+        if (sym && *sym) {
+            g_string_append_printf(buf, "%s;", sym);
+        }
+        g_string_append_printf(buf, "0x%" VADDR_PRIx " %" PRIu64 "\n",
+                               entries[i].pc, entries[i].count);
+    }
+    debuginfo_unlock();
+
+    if (nb_idle) {
+        g_string_append_printf(buf, "[idle] %" PRIu64 "\n", nb_idle);
+    }
+
+    g_free(q);
+    g_free(entries);
+}
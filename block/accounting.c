@@ -26,15 +26,39 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/coroutine-tls.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
 static const int qtest_latency_ns = NANOSECONDS_PER_SECOND / 1000;
 
+/* Index of this thread's shard plus one, zero if none was assigned yet */
+QEMU_DEFINE_STATIC_CO_TLS(unsigned int, acct_shard);
+static unsigned int acct_next_shard;
+
+/*
+ * Shards are handed out round-robin to threads the first time they account
+ * a request.  With more threads than shards, some share one; this is still
+ * correct because the counters are updated atomically.
+ */
+static unsigned int block_acct_shard_index(void)
+{
+    unsigned int shard = get_acct_shard();
+
+    if (!shard) {
+        shard = qatomic_fetch_inc(&acct_next_shard) % BLOCK_ACCT_SHARDS + 1;
+        set_acct_shard(shard);
+    }
+    return shard - 1;
+}
+
 void block_acct_init(BlockAcctStats *stats)
 {
     qemu_mutex_init(&stats->lock);
+    stats->shards = qemu_memalign(BLOCK_ACCT_SHARD_ALIGN,
+                                  BLOCK_ACCT_SHARDS * sizeof(BlockAcctShard));
+    memset(stats->shards, 0, BLOCK_ACCT_SHARDS * sizeof(BlockAcctShard));
     if (qtest_enabled()) {
         clock_type = QEMU_CLOCK_VIRTUAL;
     }
@@ -71,6 +95,8 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    block_latency_histograms_clear(stats);
+    qemu_vfree(stats->shards);
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -127,43 +153,67 @@ static int block_latency_histogram_compare_func(const void *key, const void *it)
     return k < a ? -1 : (k < b ? 0 : 1);
 }
 
-static void block_latency_histogram_account(BlockLatencyHistogram *hist,
+static void block_latency_histogram_account(BlockAcctStats *stats,
+                                            enum BlockAcctType type,
+                                            unsigned int shard,
                                             int64_t latency_ns)
 {
+    BlockLatencyHistogram *hist;
     uint64_t *pos;
+    int bin;
+
+    RCU_READ_LOCK_GUARD();
 
-    if (hist->bins == NULL) {
+    hist = qatomic_rcu_read(&stats->latency_histogram[type]);
+    if (hist == NULL) {
         /* histogram disabled */
         return;
     }
 
-
     if (latency_ns < hist->boundaries[0]) {
-        hist->bins[0]++;
-        return;
+        bin = 0;
+    } else if (latency_ns >= hist->boundaries[hist->nbins - 2]) {
+        bin = hist->nbins - 1;
+    } else {
+        pos = bsearch(&latency_ns, hist->boundaries, hist->nbins - 2,
+                      sizeof(hist->boundaries[0]),
+                      block_latency_histogram_compare_func);
+        assert(pos != NULL);
+        bin = pos - hist->boundaries + 1;
     }
 
-    if (latency_ns >= hist->boundaries[hist->nbins - 2]) {
-        hist->bins[hist->nbins - 1]++;
-        return;
-    }
+    stat64_add(&hist->bins[shard * hist->stride + bin], 1);
+}
+
+static void block_latency_histogram_free(BlockLatencyHistogram *hist)
+{
+    g_free(hist->boundaries);
+    qemu_vfree(hist->bins);
+    g_free(hist);
+}
 
-    pos = bsearch(&latency_ns, hist->boundaries, hist->nbins - 2,
-                  sizeof(hist->boundaries[0]),
-                  block_latency_histogram_compare_func);
-    assert(pos != NULL);
+/* Publish @hist, which may be NULL, and free the old histogram for @type */
+static void block_latency_histogram_replace(BlockAcctStats *stats,
+                                            enum BlockAcctType type,
+                                            BlockLatencyHistogram *hist)
+{
+    BlockLatencyHistogram *old = stats->latency_histogram[type];
 
-    hist->bins[pos - hist->boundaries + 1]++;
+    qatomic_rcu_set(&stats->latency_histogram[type], hist);
+    if (old) {
+        call_rcu(old, block_latency_histogram_free, rcu);
+    }
 }
 
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries)
 {
-    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+    BlockLatencyHistogram *hist;
     uint64List *entry;
     uint64_t *ptr;
     uint64_t prev = 0;
     int new_nbins = 1;
+    size_t size;
 
     for (entry = boundaries; entry; entry = entry->next) {
         if (entry->value <= prev) {
@@ -173,8 +223,8 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
         prev = entry->value;
     }
 
+    hist = g_new0(BlockLatencyHistogram, 1);
     hist->nbins = new_nbins;
-    g_free(hist->boundaries);
     hist->boundaries = g_new(uint64_t, hist->nbins - 1);
     for (entry = boundaries, ptr = hist->boundaries; entry;
          entry = entry->next, ptr++)
@@ -182,9 +232,14 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
         *ptr = entry->value;
     }
 
-    g_free(hist->bins);
-    hist->bins = g_new0(uint64_t, hist->nbins);
+    /* Start the bins of each shard on a cache line of their own */
+    hist->stride = QEMU_ALIGN_UP(hist->nbins,
+                                 BLOCK_ACCT_SHARD_ALIGN / sizeof(Stat64));
+    size = BLOCK_ACCT_SHARDS * hist->stride * sizeof(Stat64);
+    hist->bins = qemu_memalign(BLOCK_ACCT_SHARD_ALIGN, size);
+    memset(hist->bins, 0, size);
 
+    block_latency_histogram_replace(stats, type, hist);
     return 0;
 }
 
@@ -193,17 +248,29 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     int i;
 
     for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
-        BlockLatencyHistogram *hist = &stats->latency_histogram[i];
-        g_free(hist->bins);
-        g_free(hist->boundaries);
-        memset(hist, 0, sizeof(*hist));
+        block_latency_histogram_replace(stats, i, NULL);
     }
 }
 
+/* Return the number of requests in @bin; call with the RCU read lock held */
+uint64_t block_latency_histogram_bin(BlockLatencyHistogram *hist, int bin)
+{
+    uint64_t sum = 0;
+    unsigned int i;
+
+    assert(bin < hist->nbins);
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        sum += stat64_get(&hist->bins[i * hist->stride + bin]);
+    }
+    return sum;
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
     BlockAcctTimedStats *s;
+    BlockAcctShard *shard;
+    unsigned int idx;
     int64_t time_ns = qemu_clock_get_ns(clock_type);
     int64_t latency_ns = time_ns - cookie->start_time_ns;
 
@@ -217,23 +284,32 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         return;
     }
 
-    WITH_QEMU_LOCK_GUARD(&stats->lock) {
-        if (failed) {
-            stats->failed_ops[cookie->type]++;
-        } else {
-            stats->nr_bytes[cookie->type] += cookie->bytes;
-            stats->nr_ops[cookie->type]++;
-        }
-
-        block_latency_histogram_account(&stats->latency_histogram[cookie->type],
-                                        latency_ns);
+    idx = block_acct_shard_index();
+    shard = &stats->shards[idx];
 
-        if (!failed || stats->account_failed) {
-            stats->total_time_ns[cookie->type] += latency_ns;
-            stats->last_access_time_ns = time_ns;
+    if (failed) {
+        stat64_add(&shard->failed_ops[cookie->type], 1);
+    } else {
+        stat64_add(&shard->nr_bytes[cookie->type], cookie->bytes);
+        stat64_add(&shard->nr_ops[cookie->type], 1);
+    }
 
-            QSLIST_FOREACH(s, &stats->intervals, entries) {
-                timed_average_account(&s->latency[cookie->type], latency_ns);
+    block_latency_histogram_account(stats, cookie->type, idx, latency_ns);
+
+    if (!failed || stats->account_failed) {
+        stat64_add(&shard->total_time_ns[cookie->type], latency_ns);
+        stat64_max(&shard->last_access_time_ns, time_ns);
+
+        /*
+         * Intervals are only added while the device is created, so there
+         * is no need to take the lock if there are none.
+         */
+        if (!QSLIST_EMPTY(&stats->intervals)) {
+            WITH_QEMU_LOCK_GUARD(&stats->lock) {
+                QSLIST_FOREACH(s, &stats->intervals, entries) {
+                    timed_average_account(&s->latency[cookie->type],
+                                          latency_ns);
+                }
             }
         }
     }
@@ -253,34 +329,74 @@ void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie)
 
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
 {
+    BlockAcctShard *shard = &stats->shards[block_acct_shard_index()];
+
     assert(type < BLOCK_MAX_IOTYPE);
 
     /* block_account_one_io() updates total_time_ns[], but this one does
      * not.  The reason is that invalid requests are accounted during their
      * submission, therefore there's no actual I/O involved.
      */
-    qemu_mutex_lock(&stats->lock);
-    stats->invalid_ops[type]++;
+    stat64_add(&shard->invalid_ops[type], 1);
 
     if (stats->account_invalid) {
-        stats->last_access_time_ns = qemu_clock_get_ns(clock_type);
+        stat64_max(&shard->last_access_time_ns,
+                   qemu_clock_get_ns(clock_type));
     }
-    qemu_mutex_unlock(&stats->lock);
 }
 
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                       int num_requests)
 {
+    BlockAcctShard *shard = &stats->shards[block_acct_shard_index()];
+
     assert(type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-    stats->merged[type] += num_requests;
-    qemu_mutex_unlock(&stats->lock);
+    stat64_add(&shard->merged[type], num_requests);
+}
+
+static int64_t block_acct_last_access_time_ns(BlockAcctStats *stats)
+{
+    uint64_t last = 0;
+    unsigned int i;
+
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        last = MAX(last, stat64_get(&stats->shards[i].last_access_time_ns));
+    }
+    return last;
+}
+
+/*
+ * Add up the counters of all shards.  Requests that complete concurrently
+ * may or may not be included, but each counter is read atomically.
+ */
+void block_acct_get_counters(BlockAcctStats *stats,
+                             BlockAcctCounters *counters)
+{
+    unsigned int i, type;
+
+    memset(counters, 0, sizeof(*counters));
+    for (i = 0; i < BLOCK_ACCT_SHARDS; i++) {
+        BlockAcctShard *shard = &stats->shards[i];
+
+        for (type = 0; type < BLOCK_MAX_IOTYPE; type++) {
+            counters->nr_bytes[type] += stat64_get(&shard->nr_bytes[type]);
+            counters->nr_ops[type] += stat64_get(&shard->nr_ops[type]);
+            counters->invalid_ops[type] +=
+                stat64_get(&shard->invalid_ops[type]);
+            counters->failed_ops[type] += stat64_get(&shard->failed_ops[type]);
+            counters->total_time_ns[type] +=
+                stat64_get(&shard->total_time_ns[type]);
+            counters->merged[type] += stat64_get(&shard->merged[type]);
+        }
+    }
+    counters->last_access_time_ns = block_acct_last_access_time_ns(stats);
 }
 
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
-    return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
+    return qemu_clock_get_ns(clock_type) -
+           block_acct_last_access_time_ns(stats);
 }
 
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
@@ -372,6 +372,8 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     if (!copy_bitmap) {
         return NULL;
     }
+    /* Usually all dirty at first, then cleared as the copy progresses */
+    bdrv_dirty_bitmap_set_sparse(copy_bitmap, true);
     bdrv_disable_dirty_bitmap(copy_bitmap);
     if (bitmap) {
         if (!bdrv_merge_dirty_bitmap(copy_bitmap, bitmap, NULL, errp)) {
@@ -58,7 +58,8 @@ struct BdrvDirtyBitmap {
 
 struct BdrvDirtyBitmapIter {
     HBitmapIter hbi;
-    BdrvDirtyBitmap *bitmap;
+    BdrvDirtyBitmap *bitmap;    /* NULL for snapshot iterators */
+    HBitmap *snapshot;
 };
 
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
@@ -231,6 +232,7 @@ int bdrv_dirty_bitmap_create_successor(BdrvDirtyBitmap *bitmap, Error **errp)
 
     /* Successor will be on or off based on our current state. */
     child->disabled = bitmap->disabled;
+    hbitmap_set_sparse(child->bitmap, hbitmap_is_sparse(bitmap->bitmap));
     bitmap->disabled = true;
 
     /* Install the successor and mark the parent as busy */
@@ -515,22 +517,54 @@ uint32_t bdrv_dirty_bitmap_granularity(const BdrvDirtyBitmap *bitmap)
     return 1U << hbitmap_granularity(bitmap->bitmap);
 }
 
+/*
+ * Store @bitmap in a compressed form, that does not use memory for the
+ * areas that are entirely clean or entirely dirty.
+ */
+void bdrv_dirty_bitmap_set_sparse(BdrvDirtyBitmap *bitmap, bool sparse)
+{
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    hbitmap_set_sparse(bitmap->bitmap, sparse);
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
 BdrvDirtyBitmapIter *bdrv_dirty_iter_new(BdrvDirtyBitmap *bitmap)
 {
-    BdrvDirtyBitmapIter *iter = g_new(BdrvDirtyBitmapIter, 1);
+    BdrvDirtyBitmapIter *iter = g_new0(BdrvDirtyBitmapIter, 1);
     hbitmap_iter_init(&iter->hbi, bitmap->bitmap, 0);
     iter->bitmap = bitmap;
     bitmap->active_iterators++;
     return iter;
 }
 
+/*
+ * Iterate over a copy of @bitmap taken now.  The copy is private to the
+ * iterator, so that it can be advanced from any thread without the BQL or
+ * the dirty bitmap lock, and @bitmap can be modified or released meanwhile.
+ */
+BdrvDirtyBitmapIter *bdrv_dirty_iter_new_snapshot(BdrvDirtyBitmap *bitmap)
+{
+    BdrvDirtyBitmapIter *iter = g_new0(BdrvDirtyBitmapIter, 1);
+
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    iter->snapshot = hbitmap_copy(bitmap->bitmap);
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+
+    hbitmap_iter_init(&iter->hbi, iter->snapshot, 0);
+    return iter;
+}
+
 void bdrv_dirty_iter_free(BdrvDirtyBitmapIter *iter)
 {
     if (!iter) {
         return;
     }
-    assert(iter->bitmap->active_iterators > 0);
-    iter->bitmap->active_iterators--;
+    if (iter->snapshot) {
+        hbitmap_free(iter->snapshot);
+    } else {
+        assert(iter->bitmap->active_iterators > 0);
+        iter->bitmap->active_iterators--;
+    }
     g_free(iter);
 }
 
@@ -582,6 +616,7 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
         HBitmap *backup = bitmap->bitmap;
         bitmap->bitmap = hbitmap_alloc(bitmap->size,
                                        hbitmap_granularity(backup));
+        hbitmap_set_sparse(bitmap->bitmap, hbitmap_is_sparse(backup));
         *out = backup;
     }
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
@@ -876,6 +911,7 @@ void bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
     if (backup) {
         *backup = dest->bitmap;
         dest->bitmap = hbitmap_alloc(dest->size, hbitmap_granularity(*backup));
+        hbitmap_set_sparse(dest->bitmap, hbitmap_is_sparse(*backup));
         hbitmap_merge(*backup, src->bitmap, dest->bitmap);
     } else {
         hbitmap_merge(dest->bitmap, src->bitmap, dest->bitmap);
@@ -493,14 +493,31 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     source = s->mirror_top_bs->backing->bs;
     bdrv_graph_co_rdunlock();
 
+    /*
+     * s->dbi walks a snapshot of the dirty bitmap, so its position stays
+     * valid while guest writes and active mode requests modify the bitmap.
+     * Skip the areas that were cleaned since the snapshot was taken; the
+     * areas dirtied since are found by the next pass, with a new snapshot.
+     */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    offset = bdrv_dirty_iter_next(s->dbi);
-    if (offset < 0) {
-        bdrv_set_dirty_iter(s->dbi, 0);
+    do {
         offset = bdrv_dirty_iter_next(s->dbi);
-        trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
-        assert(offset >= 0);
-    }
+        if (offset < 0) {
+            bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
+            bdrv_dirty_iter_free(s->dbi);
+            s->dbi = bdrv_dirty_iter_new_snapshot(s->dirty_bitmap);
+            bdrv_dirty_bitmap_lock(s->dirty_bitmap);
+            trace_mirror_restart_iter(s,
+                                      bdrv_get_dirty_count(s->dirty_bitmap));
+
+            offset = bdrv_dirty_iter_next(s->dbi);
+            if (offset < 0) {
+                /* Active mode writes cleaned the rest meanwhile */
+                bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
+                return;
+            }
+        }
+    } while (!bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, offset));
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     /*
@@ -518,7 +535,6 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
      * one, and wait for in flight requests in them. */
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     while (nb_chunks * s->granularity < s->buf_size) {
-        int64_t next_dirty;
         int64_t next_offset = offset + nb_chunks * s->granularity;
         int64_t next_chunk = next_offset / s->granularity;
         if (next_offset >= s->bdev_length ||
@@ -528,14 +544,6 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
         if (test_bit(next_chunk, s->in_flight_bitmap)) {
             break;
         }
-
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
-        if (next_dirty > next_offset || next_dirty < 0) {
-            /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
-        }
-        assert(next_dirty == next_offset);
         nb_chunks++;
     }
 
@@ -1029,7 +1037,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     mirror_top_opaque->job = s;
 
     assert(!s->dbi);
-    s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    s->dbi = bdrv_dirty_iter_new_snapshot(s->dirty_bitmap);
     for (;;) {
         int64_t cnt, delta;
         bool should_complete;
@@ -1890,6 +1898,8 @@ static BlockJob *mirror_start_job(
     if (!s->dirty_bitmap) {
         goto fail;
     }
+    /* Usually all dirty at first, then cleared as the copy progresses */
+    bdrv_dirty_bitmap_set_sparse(s->dirty_bitmap, true);
 
     /*
      * The dirty bitmap is set by bdrv_mirror_top_do_write() when not in active
@@ -477,17 +477,26 @@ static uint64List *uint64_list(uint64_t *list, int size)
 }
 
 static BlockLatencyHistogramInfo *
-bdrv_latency_histogram_stats(BlockLatencyHistogram *hist)
+bdrv_latency_histogram_stats(BlockAcctStats *stats, enum BlockAcctType type)
 {
+    BlockLatencyHistogram *hist;
     BlockLatencyHistogramInfo *info;
+    uint64List **tail;
+    int i;
+
+    RCU_READ_LOCK_GUARD();
 
-    if (!hist->bins) {
+    hist = qatomic_rcu_read(&stats->latency_histogram[type]);
+    if (!hist) {
         return NULL;
     }
 
     info = g_new0(BlockLatencyHistogramInfo, 1);
     info->boundaries = uint64_list(hist->boundaries, hist->nbins - 1);
-    info->bins = uint64_list(hist->bins, hist->nbins);
+    tail = &info->bins;
+    for (i = 0; i < hist->nbins; i++) {
+        QAPI_LIST_APPEND(tail, block_latency_histogram_bin(hist, i));
+    }
     return info;
 }
 
@@ -495,45 +504,47 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
-    BlockLatencyHistogram *hgram;
-
-    ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
-    ds->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
-    ds->zone_append_bytes = stats->nr_bytes[BLOCK_ACCT_ZONE_APPEND];
-    ds->unmap_bytes = stats->nr_bytes[BLOCK_ACCT_UNMAP];
-    ds->rd_operations = stats->nr_ops[BLOCK_ACCT_READ];
-    ds->wr_operations = stats->nr_ops[BLOCK_ACCT_WRITE];
-    ds->zone_append_operations = stats->nr_ops[BLOCK_ACCT_ZONE_APPEND];
-    ds->unmap_operations = stats->nr_ops[BLOCK_ACCT_UNMAP];
-
-    ds->failed_rd_operations = stats->failed_ops[BLOCK_ACCT_READ];
-    ds->failed_wr_operations = stats->failed_ops[BLOCK_ACCT_WRITE];
+    BlockAcctCounters counters;
+
+    block_acct_get_counters(stats, &counters);
+
+    ds->rd_bytes = counters.nr_bytes[BLOCK_ACCT_READ];
+    ds->wr_bytes = counters.nr_bytes[BLOCK_ACCT_WRITE];
+    ds->zone_append_bytes = counters.nr_bytes[BLOCK_ACCT_ZONE_APPEND];
+    ds->unmap_bytes = counters.nr_bytes[BLOCK_ACCT_UNMAP];
+    ds->rd_operations = counters.nr_ops[BLOCK_ACCT_READ];
+    ds->wr_operations = counters.nr_ops[BLOCK_ACCT_WRITE];
+    ds->zone_append_operations = counters.nr_ops[BLOCK_ACCT_ZONE_APPEND];
+    ds->unmap_operations = counters.nr_ops[BLOCK_ACCT_UNMAP];
+
+    ds->failed_rd_operations = counters.failed_ops[BLOCK_ACCT_READ];
+    ds->failed_wr_operations = counters.failed_ops[BLOCK_ACCT_WRITE];
     ds->failed_zone_append_operations =
-        stats->failed_ops[BLOCK_ACCT_ZONE_APPEND];
-    ds->failed_flush_operations = stats->failed_ops[BLOCK_ACCT_FLUSH];
-    ds->failed_unmap_operations = stats->failed_ops[BLOCK_ACCT_UNMAP];
+        counters.failed_ops[BLOCK_ACCT_ZONE_APPEND];
+    ds->failed_flush_operations = counters.failed_ops[BLOCK_ACCT_FLUSH];
+    ds->failed_unmap_operations = counters.failed_ops[BLOCK_ACCT_UNMAP];
 
-    ds->invalid_rd_operations = stats->invalid_ops[BLOCK_ACCT_READ];
-    ds->invalid_wr_operations = stats->invalid_ops[BLOCK_ACCT_WRITE];
+    ds->invalid_rd_operations = counters.invalid_ops[BLOCK_ACCT_READ];
+    ds->invalid_wr_operations = counters.invalid_ops[BLOCK_ACCT_WRITE];
     ds->invalid_zone_append_operations =
-        stats->invalid_ops[BLOCK_ACCT_ZONE_APPEND];
+        counters.invalid_ops[BLOCK_ACCT_ZONE_APPEND];
     ds->invalid_flush_operations =
-        stats->invalid_ops[BLOCK_ACCT_FLUSH];
-    ds->invalid_unmap_operations = stats->invalid_ops[BLOCK_ACCT_UNMAP];
-
-    ds->rd_merged = stats->merged[BLOCK_ACCT_READ];
-    ds->wr_merged = stats->merged[BLOCK_ACCT_WRITE];
-    ds->zone_append_merged = stats->merged[BLOCK_ACCT_ZONE_APPEND];
-    ds->unmap_merged = stats->merged[BLOCK_ACCT_UNMAP];
-    ds->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
-    ds->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
+        counters.invalid_ops[BLOCK_ACCT_FLUSH];
+    ds->invalid_unmap_operations = counters.invalid_ops[BLOCK_ACCT_UNMAP];
+
+    ds->rd_merged = counters.merged[BLOCK_ACCT_READ];
+    ds->wr_merged = counters.merged[BLOCK_ACCT_WRITE];
+    ds->zone_append_merged = counters.merged[BLOCK_ACCT_ZONE_APPEND];
+    ds->unmap_merged = counters.merged[BLOCK_ACCT_UNMAP];
+    ds->flush_operations = counters.nr_ops[BLOCK_ACCT_FLUSH];
+    ds->wr_total_time_ns = counters.total_time_ns[BLOCK_ACCT_WRITE];
     ds->zone_append_total_time_ns =
-        stats->total_time_ns[BLOCK_ACCT_ZONE_APPEND];
-    ds->rd_total_time_ns = stats->total_time_ns[BLOCK_ACCT_READ];
-    ds->flush_total_time_ns = stats->total_time_ns[BLOCK_ACCT_FLUSH];
-    ds->unmap_total_time_ns = stats->total_time_ns[BLOCK_ACCT_UNMAP];
+        counters.total_time_ns[BLOCK_ACCT_ZONE_APPEND];
+    ds->rd_total_time_ns = counters.total_time_ns[BLOCK_ACCT_READ];
+    ds->flush_total_time_ns = counters.total_time_ns[BLOCK_ACCT_FLUSH];
+    ds->unmap_total_time_ns = counters.total_time_ns[BLOCK_ACCT_UNMAP];
 
-    ds->has_idle_time_ns = stats->last_access_time_ns > 0;
+    ds->has_idle_time_ns = counters.last_access_time_ns > 0;
     if (ds->has_idle_time_ns) {
         ds->idle_time_ns = block_acct_idle_time_ns(stats);
     }
@@ -577,15 +588,14 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         QAPI_LIST_PREPEND(ds->timed_stats, dev_stats);
     }
 
-    hgram = stats->latency_histogram;
     ds->rd_latency_histogram
-        = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_READ]);
+        = bdrv_latency_histogram_stats(stats, BLOCK_ACCT_READ);
     ds->wr_latency_histogram
-        = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_WRITE]);
+        = bdrv_latency_histogram_stats(stats, BLOCK_ACCT_WRITE);
     ds->zone_append_latency_histogram
-        = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_ZONE_APPEND]);
+        = bdrv_latency_histogram_stats(stats, BLOCK_ACCT_ZONE_APPEND);
     ds->flush_latency_histogram
-        = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
+        = bdrv_latency_histogram_stats(stats, BLOCK_ACCT_FLUSH);
 }
 
 static BlockStats * GRAPH_RDLOCK
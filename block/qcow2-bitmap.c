@@ -353,6 +353,12 @@ BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
+    /*
+     * Persistent bitmaps are mostly clean, and qcow2 stores clean clusters
+     * of the bitmap as zero entries in the table; do not use memory for them.
+     */
+    bdrv_dirty_bitmap_set_sparse(bitmap, true);
+
     if (bm->flags & BME_FLAG_IN_USE) {
         /* Data is unusable, skip loading it */
         return bitmap;
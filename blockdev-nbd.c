@@ -20,6 +20,7 @@
 #include "block/nbd.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
+#include "sysemu/iothread.h"
 
 typedef struct NBDServerData {
     QIONetListener *listener;
@@ -27,6 +28,10 @@ typedef struct NBDServerData {
     char *tlsauthz;
     uint32_t max_connections;
     uint32_t connections;
+    IOThread **iothreads;   /* connections are assigned to these round-robin */
+    unsigned int nr_iothreads;
+    unsigned int next_iothread;
+    bool zero_copy_send;
 } NBDServerData;
 
 static NBDServerData *nbd_server;
@@ -60,11 +65,22 @@ static void nbd_blockdev_client_closed(NBDClient *client, bool ignored)
 static void nbd_accept(QIONetListener *listener, QIOChannelSocket *cioc,
                        gpointer opaque)
 {
+    AioContext *ctx = NULL;
+
     nbd_server->connections++;
     nbd_update_server_watch(nbd_server);
 
+    if (nbd_server->nr_iothreads) {
+        IOThread *iothread = nbd_server->iothreads[nbd_server->next_iothread];
+
+        ctx = iothread_get_aio_context(iothread);
+        nbd_server->next_iothread =
+            (nbd_server->next_iothread + 1) % nbd_server->nr_iothreads;
+    }
+
     qio_channel_set_name(QIO_CHANNEL(cioc), "nbd-server");
-    nbd_client_new(cioc, nbd_server->tlscreds, nbd_server->tlsauthz,
+    nbd_client_new(cioc, ctx, nbd_server->zero_copy_send,
+                   nbd_server->tlscreds, nbd_server->tlsauthz,
                    nbd_blockdev_client_closed);
 }
 
@@ -79,6 +95,8 @@ static void nbd_update_server_watch(NBDServerData *s)
 
 static void nbd_server_free(NBDServerData *server)
 {
+    unsigned int i;
+
     if (!server) {
         return;
     }
@@ -89,6 +107,10 @@ static void nbd_server_free(NBDServerData *server)
         object_unref(OBJECT(server->tlscreds));
     }
     g_free(server->tlsauthz);
+    for (i = 0; i < server->nr_iothreads; i++) {
+        object_unref(OBJECT(server->iothreads[i]));
+    }
+    g_free(server->iothreads);
 
     g_free(server);
 }
@@ -123,8 +145,28 @@ static QCryptoTLSCreds *nbd_get_tls_creds(const char *id, Error **errp)
 }
 
 
+static bool nbd_server_set_iothreads(NBDServerData *server,
+                                     strList *iothreads, Error **errp)
+{
+    strList *e;
+
+    server->iothreads = g_new(IOThread *, QAPI_LIST_LENGTH(iothreads));
+    for (e = iothreads; e; e = e->next) {
+        IOThread *iothread = iothread_by_id(e->value);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread '%s' not found", e->value);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        server->iothreads[server->nr_iothreads++] = iothread;
+    }
+    return true;
+}
+
 void nbd_server_start(SocketAddress *addr, const char *tls_creds,
                       const char *tls_authz, uint32_t max_connections,
+                      strList *iothreads, bool zero_copy_send,
                       Error **errp)
 {
     if (nbd_server) {
@@ -134,6 +176,7 @@ void nbd_server_start(SocketAddress *addr, const char *tls_creds,
 
     nbd_server = g_new0(NBDServerData, 1);
     nbd_server->max_connections = max_connections;
+    nbd_server->zero_copy_send = zero_copy_send;
     nbd_server->listener = qio_net_listener_new();
 
     qio_net_listener_set_name(nbd_server->listener,
@@ -157,6 +200,10 @@ void nbd_server_start(SocketAddress *addr, const char *tls_creds,
 
     nbd_server->tlsauthz = g_strdup(tls_authz);
 
+    if (!nbd_server_set_iothreads(nbd_server, iothreads, errp)) {
+        goto error;
+    }
+
     nbd_update_server_watch(nbd_server);
 
     return;
@@ -169,18 +216,22 @@ void nbd_server_start(SocketAddress *addr, const char *tls_creds,
 void nbd_server_start_options(NbdServerOptions *arg, Error **errp)
 {
     nbd_server_start(arg->addr, arg->tls_creds, arg->tls_authz,
-                     arg->max_connections, errp);
+                     arg->max_connections, arg->iothreads,
+                     arg->zero_copy_send, errp);
 }
 
 void qmp_nbd_server_start(SocketAddressLegacy *addr,
                           const char *tls_creds,
                           const char *tls_authz,
                           bool has_max_connections, uint32_t max_connections,
+                          bool has_iothreads, strList *iothreads,
+                          bool has_zero_copy_send, bool zero_copy_send,
                           Error **errp)
 {
     SocketAddress *addr_flat = socket_address_flatten(addr);
 
-    nbd_server_start(addr_flat, tls_creds, tls_authz, max_connections, errp);
+    nbd_server_start(addr_flat, tls_creds, tls_authz, max_connections,
+                     iothreads, zero_copy_send, errp);
     qapi_free_SocketAddress(addr_flat);
 }
 
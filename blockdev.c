@@ -1862,6 +1862,7 @@ static void block_dirty_bitmap_add_action(BlockDirtyBitmapAdd *action,
                                action->has_granularity, action->granularity,
                                action->has_persistent, action->persistent,
                                action->has_disabled, action->disabled,
+                               action->has_sparse, action->sparse,
                                &local_err);
 
     if (!local_err) {
@@ -283,6 +283,21 @@ SRST
     Show dynamic compiler opcode counters
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show samples of the TCG profiler as collapsed stacks",
+    },
+#endif
+
+SRST
+  ``info tcg-profile``
+    Show the samples taken by ``tcg-profile``, one line per translation
+    block in the collapsed stack format used by flamegraph tools.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
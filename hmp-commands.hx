@@ -398,6 +398,24 @@ SRST
   If called with option off, the emulation returns to normal mode.
 ERST
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tcg-profile",
+        .args_type  = "enable:b,interval:i?",
+        .params     = "on|off [interval]",
+        .help       = "start or stop sampling of TCG translated code",
+        .cmd        = hmp_tcg_profile,
+    },
+#endif
+
+SRST
+``tcg-profile on|off [interval]``
+  Start or stop sampling which guest translation blocks the vCPUs are
+  executing, once every *interval* microseconds (default 1000).  Starting
+  discards earlier samples; if sampling is already running, it continues
+  with the new interval.  The samples are shown by ``info tcg-profile``.
+ERST
+
     {
         .name       = "stop|s",
         .args_type  = "",
@@ -17,9 +17,12 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/sockets.h"
+#include "qemu/xxhash.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/eth.h"
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
@@ -32,13 +35,16 @@
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/qapi-events-net.h"
+#include "qapi/qapi-visit-net.h"
 #include "hw/qdev-properties.h"
 #include "qapi/qapi-types-migration.h"
 #include "qapi/qapi-events-migration.h"
 #include "hw/virtio/virtio-access.h"
 #include "migration/misc.h"
 #include "standard-headers/linux/ethtool.h"
+#include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "trace.h"
 #include "monitor/qdev.h"
@@ -599,6 +605,8 @@ static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
     }
 }
 
+static void virtio_net_flow_steering_reset(VirtIONet *n);
+
 static void virtio_net_reset(VirtIODevice *vdev)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -630,7 +638,11 @@ static void virtio_net_reset(VirtIODevice *vdev)
     /* Flush any async TX */
     for (i = 0;  i < n->max_queue_pairs; i++) {
         flush_or_purge_queued_packets(qemu_get_subqueue(n->nic, i));
+        if (n->vqs[i].gro) {
+            net_gro_purge(n->vqs[i].gro);
+        }
     }
+    virtio_net_flow_steering_reset(n);
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -804,9 +816,12 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
 
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
+        /* GRO builds the GSO frames that the peer cannot provide */
+        if (!n->net_conf.gro) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
+        }
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
 
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_USO);
@@ -1016,6 +1031,9 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
+    } else if (n->net_conf.gro) {
+        n->curr_guest_offloads =
+            virtio_net_guest_offloads_by_features(features);
     }
 
     for (i = 0;  i < n->max_queue_pairs; i++) {
@@ -1105,7 +1123,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
 
         offloads = virtio_ldq_p(vdev, &offloads);
 
-        if (!n->has_vnet_hdr) {
+        if (!n->has_vnet_hdr && !n->net_conf.gro) {
             return VIRTIO_NET_ERR;
         }
 
@@ -1121,7 +1139,9 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
         }
 
         n->curr_guest_offloads = offloads;
-        virtio_net_apply_guest_offloads(n);
+        if (n->has_vnet_hdr) {
+            virtio_net_apply_guest_offloads(n);
+        }
 
         return VIRTIO_NET_OK;
     } else {
@@ -1637,10 +1657,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         if (written > 0) {
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
-            g_free(elem);
+            virtqueue_element_free(elem);
         } else {
             virtqueue_detach_element(vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             break;
         }
     }
@@ -1648,11 +1668,17 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
 /* RX */
 
+static void virtio_net_gro_flush(VirtIONetQueue *q);
+
 static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
 
+    if (q->gro && net_gro_has_pending(q->gro)) {
+        virtio_net_gro_flush(q);
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -1737,7 +1763,8 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *gso_hdr)
 {
     if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
@@ -1749,6 +1776,11 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
             virtio_net_hdr_swap(VIRTIO_DEVICE(n), wbuf);
         }
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
+    } else if (gso_hdr) {
+        struct virtio_net_hdr hdr = *gso_hdr;
+
+        virtio_net_hdr_swap(VIRTIO_DEVICE(n), &hdr);
+        iov_from_buf(iov, iov_cnt, 0, &hdr, sizeof hdr);
     } else {
         struct virtio_net_hdr hdr = {
             .flags = 0,
@@ -1928,8 +1960,331 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/* Flow steering */
+
+static bool virtio_net_flow_key(const struct iovec *iov, int iovcnt,
+                                size_t offset, VirtioNetFlowKey *key)
+{
+    bool hasip4, hasip6;
+    size_t l3hdr_off, l4hdr_off, l5hdr_off;
+    eth_ip6_hdr_info ip6hdr_info;
+    eth_ip4_hdr_info ip4hdr_info;
+    eth_l4_hdr_info l4hdr_info;
+
+    eth_get_protocols(iov, iovcnt, offset, &hasip4, &hasip6,
+                      &l3hdr_off, &l4hdr_off, &l5hdr_off,
+                      &ip6hdr_info, &ip4hdr_info, &l4hdr_info);
+
+    memset(key, 0, sizeof(*key));
+    switch (l4hdr_info.proto) {
+    case ETH_L4_HDR_PROTO_TCP:
+        key->proto = IP_PROTO_TCP;
+        key->src_port = l4hdr_info.hdr.tcp.th_sport;
+        key->dst_port = l4hdr_info.hdr.tcp.th_dport;
+        break;
+    case ETH_L4_HDR_PROTO_UDP:
+        key->proto = IP_PROTO_UDP;
+        key->src_port = l4hdr_info.hdr.udp.uh_sport;
+        key->dst_port = l4hdr_info.hdr.udp.uh_dport;
+        break;
+    default:
+        return false;
+    }
+
+    if (hasip4) {
+        memcpy(key->src_ip, &ip4hdr_info.ip4_hdr.ip_src, 4);
+        memcpy(key->dst_ip, &ip4hdr_info.ip4_hdr.ip_dst, 4);
+    } else {
+        key->ipv6 = true;
+        memcpy(key->src_ip, &ip6hdr_info.ip6_hdr.ip6_src, 16);
+        memcpy(key->dst_ip, &ip6hdr_info.ip6_hdr.ip6_dst, 16);
+    }
+    return true;
+}
+
+static uint32_t virtio_net_flow_hash(const VirtioNetFlowKey *key)
+{
+    uint64_t src[2], dst[2];
+
+    memcpy(src, key->src_ip, sizeof(src));
+    memcpy(dst, key->dst_ip, sizeof(dst));
+    return qemu_xxhash8(src[0], src[1], dst[0] ^ ror64(dst[1], 32),
+                        (uint32_t)key->src_port << 16 | key->dst_port,
+                        key->proto);
+}
+
+static bool virtio_net_flow_rule_match(const VirtioNetFlowRule *rule,
+                                       const VirtioNetFlowKey *key)
+{
+    const NetFlowRule *conf = rule->conf;
+    size_t addr_len = key->ipv6 ? 16 : 4;
+
+    if (rule->proto && rule->proto != key->proto) {
+        return false;
+    }
+    if (rule->family != AF_UNSPEC &&
+        (rule->family == AF_INET6) != key->ipv6) {
+        return false;
+    }
+    if (conf->src_ip && memcmp(rule->src_ip, key->src_ip, addr_len)) {
+        return false;
+    }
+    if (conf->dst_ip && memcmp(rule->dst_ip, key->dst_ip, addr_len)) {
+        return false;
+    }
+    if (conf->has_src_port && conf->src_port != be16_to_cpu(key->src_port)) {
+        return false;
+    }
+    if (conf->has_dst_port && conf->dst_port != be16_to_cpu(key->dst_port)) {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Returns the queue pair that flow steering picks for a received packet,
+ * or -1 if the packet is left to RSS.  Rules are looked at first, then
+ * the flows learnt by virtio_net_flow_learn().
+ */
+static int virtio_net_flow_steer(VirtIONet *n, const uint8_t *buf,
+                                 size_t size)
+{
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+    VirtioNetFlowRule *rule;
+    VirtioNetFlowKey key;
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
+    int queue = -1;
+
+    if ((QTAILQ_EMPTY(&fs->rules) && !fs->table) ||
+        !virtio_net_flow_key(&iov, 1, n->host_hdr_len, &key)) {
+        return -1;
+    }
+
+    QTAILQ_FOREACH(rule, &fs->rules, next) {
+        if (virtio_net_flow_rule_match(rule, &key)) {
+            queue = rule->conf->queue;
+            break;
+        }
+    }
+
+    if (queue < 0 && fs->table) {
+        uint32_t hash = virtio_net_flow_hash(&key);
+        VirtioNetFlowEntry *e =
+            &fs->table[hash & (VIRTIO_NET_FLOW_TABLE_SIZE - 1)];
+
+        if (e->queue && e->hash == hash) {
+            queue = e->queue - 1;
+        }
+    }
+
+    /* The guest may have reduced the number of queues since */
+    return queue < n->curr_queue_pairs ? queue : -1;
+}
+
+/*
+ * Record the queue pair on which the guest transmits a packet.  The guest
+ * picks it according to the CPU that runs the flow's socket, so replies
+ * steered to the same queue pair are processed on that CPU as well.
+ */
+static void virtio_net_flow_learn(VirtIONet *n, int queue_index,
+                                  const struct iovec *iov, unsigned int iovcnt)
+{
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+    VirtioNetFlowKey tx, rx;
+    VirtioNetFlowEntry *e;
+    uint32_t hash;
+
+    if (!fs->table ||
+        !virtio_net_flow_key(iov, iovcnt, n->guest_hdr_len, &tx)) {
+        return;
+    }
+
+    /* Received packets of the flow travel the other way */
+    rx = (VirtioNetFlowKey) {
+        .proto = tx.proto,
+        .ipv6 = tx.ipv6,
+        .src_port = tx.dst_port,
+        .dst_port = tx.src_port,
+    };
+    memcpy(rx.src_ip, tx.dst_ip, sizeof(rx.src_ip));
+    memcpy(rx.dst_ip, tx.src_ip, sizeof(rx.dst_ip));
+
+    hash = virtio_net_flow_hash(&rx);
+    e = &fs->table[hash & (VIRTIO_NET_FLOW_TABLE_SIZE - 1)];
+    if (!e->queue) {
+        fs->nr_flows++;
+    }
+    e->hash = hash;
+    e->queue = queue_index + 1;
+}
+
+static void virtio_net_flow_steering_reset(VirtIONet *n)
+{
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+
+    if (fs->table) {
+        memset(fs->table, 0,
+               VIRTIO_NET_FLOW_TABLE_SIZE * sizeof(VirtioNetFlowEntry));
+        fs->nr_flows = 0;
+    }
+}
+
+static bool virtio_net_flow_steering_supported(NetClientState *nc,
+                                               Error **errp)
+{
+    /* vhost moves packets without going through virtio_net_receive() */
+    if (get_vhost_net(nc->peer)) {
+        error_setg(errp, "flow steering is not supported with vhost");
+        return false;
+    }
+    return true;
+}
+
+static bool virtio_net_flow_parse_ip(const char *str, int *family,
+                                     uint8_t *addr, Error **errp)
+{
+    int af = strchr(str, ':') ? AF_INET6 : AF_INET;
+
+    if (inet_pton(af, str, addr) != 1) {
+        error_setg(errp, "invalid IP address '%s'", str);
+        return false;
+    }
+    if (*family != AF_UNSPEC && *family != af) {
+        error_setg(errp, "source and destination address families differ");
+        return false;
+    }
+    *family = af;
+    return true;
+}
+
+static void virtio_net_flow_rule_free(VirtioNetFlowRule *rule)
+{
+    qapi_free_NetFlowRule(rule->conf);
+    g_free(rule);
+}
+
+static bool virtio_net_flow_rule_add(NetClientState *nc,
+                                     const NetFlowRule *conf, Error **errp)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+    VirtioNetFlowRule *rule;
+
+    if (!virtio_net_flow_steering_supported(nc, errp)) {
+        return false;
+    }
+    QTAILQ_FOREACH(rule, &fs->rules, next) {
+        if (rule->conf->id == conf->id) {
+            error_setg(errp, "flow rule %" PRIu32 " already exists", conf->id);
+            return false;
+        }
+    }
+    if (conf->queue >= n->max_queue_pairs) {
+        error_setg(errp, "queue %" PRIu16 " is out of range", conf->queue);
+        return false;
+    }
+    if ((conf->has_src_port || conf->has_dst_port) && !conf->has_protocol) {
+        error_setg(errp, "matching ports requires a protocol");
+        return false;
+    }
+
+    rule = g_new0(VirtioNetFlowRule, 1);
+    rule->family = AF_UNSPEC;
+    if (conf->has_protocol) {
+        rule->proto = conf->protocol == NET_FLOW_PROTOCOL_TCP ?
+                      IP_PROTO_TCP : IP_PROTO_UDP;
+    }
+    if ((conf->src_ip && !virtio_net_flow_parse_ip(conf->src_ip,
+                                                   &rule->family,
+                                                   rule->src_ip, errp)) ||
+        (conf->dst_ip && !virtio_net_flow_parse_ip(conf->dst_ip,
+                                                   &rule->family,
+                                                   rule->dst_ip, errp))) {
+        g_free(rule);
+        return false;
+    }
+    rule->conf = QAPI_CLONE(NetFlowRule, conf);
+    QTAILQ_INSERT_TAIL(&fs->rules, rule, next);
+    return true;
+}
+
+static bool virtio_net_flow_rule_del(NetClientState *nc, uint32_t id,
+                                     Error **errp)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtioNetFlowRule *rule;
+
+    QTAILQ_FOREACH(rule, &n->flow_steering.rules, next) {
+        if (rule->conf->id == id) {
+            QTAILQ_REMOVE(&n->flow_steering.rules, rule, next);
+            virtio_net_flow_rule_free(rule);
+            return true;
+        }
+    }
+    error_setg(errp, "flow rule %" PRIu32 " not found", id);
+    return false;
+}
+
+static bool virtio_net_flow_steering_set(NetClientState *nc, bool automatic,
+                                         Error **errp)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+
+    if (!automatic) {
+        g_free(fs->table);
+        fs->table = NULL;
+        fs->nr_flows = 0;
+        return true;
+    }
+    if (!virtio_net_flow_steering_supported(nc, errp)) {
+        return false;
+    }
+    if (!fs->table) {
+        fs->table = g_new0(VirtioNetFlowEntry, VIRTIO_NET_FLOW_TABLE_SIZE);
+    }
+    return true;
+}
+
+static NetFlowSteeringInfo *virtio_net_query_flow_steering(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+    NetFlowSteeringInfo *info = g_new0(NetFlowSteeringInfo, 1);
+    NetFlowRuleList **tail = &info->rules;
+    VirtioNetFlowRule *rule;
+
+    info->q_auto = fs->table != NULL;
+    info->auto_flows = fs->nr_flows;
+    QTAILQ_FOREACH(rule, &fs->rules, next) {
+        QAPI_LIST_APPEND(tail, QAPI_CLONE(NetFlowRule, rule->conf));
+    }
+    return info;
+}
+
+static void virtio_net_flow_steering_cleanup(VirtIONet *n)
+{
+    VirtioNetFlowSteering *fs = &n->flow_steering;
+    VirtioNetFlowRule *rule, *next;
+
+    QTAILQ_FOREACH_SAFE(rule, &fs->rules, next, next) {
+        QTAILQ_REMOVE(&fs->rules, rule, next);
+        virtio_net_flow_rule_free(rule);
+    }
+    g_free(fs->table);
+    fs->table = NULL;
+}
+
+/*
+ * @gso_hdr describes a frame coalesced by GRO, in which case the peer does
+ * not supply a vnet header of its own.
+ */
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size, bool no_rss)
+                                      size_t size, bool no_rss,
+                                      const struct virtio_net_hdr *gso_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1946,11 +2301,20 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         return -1;
     }
 
-    if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss) {
-        int index = virtio_net_process_rss(nc, buf, size);
+    if (!no_rss) {
+        int index = -1, steer;
+
+        /* Run RSS even for steered packets, it computes the hash report */
+        if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
+            index = virtio_net_process_rss(nc, buf, size);
+        }
+        steer = virtio_net_flow_steer(n, buf, size);
+        if (steer >= 0) {
+            index = steer == nc->queue_index ? -1 : steer;
+        }
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
-            return virtio_net_receive_rcu(nc2, buf, size, true);
+            return virtio_net_receive_rcu(nc2, buf, size, true, gso_hdr);
         }
     }
 
@@ -1996,7 +2360,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             virtio_error(vdev,
                          "virtio-net receive queue contains no in buffers");
             virtqueue_detach_element(q->rx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = -1;
             goto err;
         }
@@ -2011,7 +2375,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, gso_hdr);
             if (n->rss_data.populate_hash) {
                 offset = sizeof(mhdr);
                 iov_from_buf(sg, elem->in_num, offset,
@@ -2034,7 +2398,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
          * Otherwise, drop it. */
         if (!n->mergeable_rx_bufs && offset < size) {
             virtqueue_unpop(q->rx_vq, elem, total);
-            g_free(elem);
+            virtqueue_element_free(elem);
             err = size;
             goto err;
         }
@@ -2054,7 +2418,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     for (j = 0; j < i; j++) {
         /* signal other side */
         virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     virtqueue_flush(q->rx_vq, i);
@@ -2065,7 +2429,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 err:
     for (j = 0; j < i; j++) {
         virtqueue_detach_element(q->rx_vq, elems[j], lens[j]);
-        g_free(elems[j]);
+        virtqueue_element_free(elems[j]);
     }
 
     return err;
@@ -2076,7 +2440,113 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
 {
     RCU_READ_LOCK_GUARD();
 
-    return virtio_net_receive_rcu(nc, buf, size, false);
+    return virtio_net_receive_rcu(nc, buf, size, false, NULL);
+}
+
+/*
+ * GRO is used for peers without a vnet header, which cannot pass on GSO
+ * frames themselves, once the guest can take them.
+ */
+static bool virtio_net_gro_active(VirtIONet *n, VirtIONetQueue *q)
+{
+    return q->gro && !n->has_vnet_hdr && n->mergeable_rx_bufs &&
+           (n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM)) &&
+           (n->curr_guest_offloads & ((1ULL << VIRTIO_NET_F_GUEST_TSO4) |
+                                      (1ULL << VIRTIO_NET_F_GUEST_TSO6)));
+}
+
+static ssize_t virtio_net_gro_deliver(void *opaque,
+                                      const struct virtio_net_hdr *hdr,
+                                      const uint8_t *buf, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = qemu_get_subqueue(q->n->nic,
+                                           vq2q(virtio_get_queue_index(q->rx_vq)));
+
+    return virtio_net_receive_rcu(nc, buf, size, false, hdr);
+}
+
+static void virtio_net_gro_flush(VirtIONetQueue *q)
+{
+    RCU_READ_LOCK_GUARD();
+
+    /* The guest may have turned off the offloads since */
+    if (!virtio_net_gro_active(q->n, q)) {
+        net_gro_purge(q->gro);
+        return;
+    }
+
+    /* What cannot go now is retried when the guest adds rx buffers */
+    net_gro_flush(q->gro);
+}
+
+static void virtio_net_gro_bh(void *opaque)
+{
+    virtio_net_gro_flush(opaque);
+}
+
+/*
+ * Held frames are not part of the migration stream.  Hand them to the
+ * guest before the device stops, while virtio_net_can_receive() still
+ * accepts them, and retry what could not go when the VM runs again.
+ */
+static void virtio_net_gro_vm_state_prepare(void *opaque, bool running,
+                                            RunState state)
+{
+    VirtIONet *n = opaque;
+    int i;
+
+    if (running) {
+        return;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->gro && net_gro_has_pending(q->gro)) {
+            qemu_bh_cancel(q->gro_bh);
+            virtio_net_gro_flush(q);
+        }
+    }
+}
+
+static void virtio_net_gro_vm_state_change(void *opaque, bool running,
+                                           RunState state)
+{
+    VirtIONet *n = opaque;
+    int i;
+
+    if (!running) {
+        return;
+    }
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->gro && net_gro_has_pending(q->gro)) {
+            qemu_bh_schedule(q->gro_bh);
+        }
+    }
+}
+
+static ssize_t virtio_net_gro_receive(NetClientState *nc, const uint8_t *buf,
+                                      size_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    ssize_t ret;
+
+    RCU_READ_LOCK_GUARD();
+
+    net_gro_set_offloads(q->gro,
+        n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4),
+        n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6));
+
+    ret = net_gro_receive(q->gro, buf, size);
+    if (net_gro_has_pending(q->gro)) {
+        qemu_bh_schedule(q->gro_bh);
+    }
+    return ret;
 }
 
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
@@ -2676,8 +3146,12 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
     if ((n->rsc4_enabled || n->rsc6_enabled)) {
         return virtio_net_rsc_receive(nc, buf, size);
+    } else if (virtio_net_gro_active(n, q)) {
+        return virtio_net_gro_receive(nc, buf, size);
     } else {
         return virtio_net_do_receive(nc, buf, size);
     }
@@ -2695,7 +3169,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2718,6 +3192,109 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Maximum number of packets handed to the peer in one call */
+#define VIRTIO_NET_TX_BATCH 64
+
+/*
+ * Packets can be sent in bursts if the header the peer wants is either the
+ * guest's header as is or nothing at all; the latter only needs the guest
+ * header to be trimmed from the front of the element, which is undone
+ * before the element is returned to the guest.
+ */
+static bool virtio_net_tx_can_batch(VirtIONet *n)
+{
+    return !n->needs_vnet_hdr_swap &&
+           (n->host_hdr_len == n->guest_hdr_len || n->host_hdr_len == 0);
+}
+
+static int32_t virtio_net_flush_tx_batch(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+    size_t hdr_discard = n->host_hdr_len ? 0 : n->guest_hdr_len;
+    int32_t num_packets = 0;
+
+    while (num_packets < n->tx_burst) {
+        VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+        unsigned int lens[VIRTIO_NET_TX_BATCH] = { 0 };
+        IOVDiscardUndo undo[VIRTIO_NET_TX_BATCH];
+        NetPacketIOV pkts[VIRTIO_NET_TX_BATCH];
+        unsigned int count, i;
+        int sent;
+
+        count = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                    (void **)elems,
+                                    MIN(VIRTIO_NET_TX_BATCH,
+                                        n->tx_burst - num_packets));
+        if (!count) {
+            break;
+        }
+
+        for (i = 0; i < count; i++) {
+            VirtQueueElement *elem = elems[i];
+            struct iovec *out_sg = elem->out_sg;
+            unsigned int out_num = elem->out_num;
+            const char *err = NULL;
+
+            if (out_num < 1) {
+                err = "virtio-net header not in first element";
+            } else if (n->has_vnet_hdr &&
+                       iov_size(out_sg, out_num) < n->guest_hdr_len) {
+                err = "virtio-net header incorrect";
+            }
+            if (err) {
+                virtio_error(vdev, "%s", err);
+                while (i-- > 0) {
+                    iov_discard_undo(&undo[i]);
+                }
+                for (i = 0; i < count; i++) {
+                    virtqueue_detach_element(q->tx_vq, elems[i], 0);
+                    virtqueue_element_free(elems[i]);
+                }
+                return -EINVAL;
+            }
+
+            virtio_net_flow_learn(n, queue_index, out_sg, out_num);
+            iov_discard_front_undoable(&out_sg, &out_num, hdr_discard,
+                                       &undo[i]);
+            pkts[i].iov = out_sg;
+            pkts[i].iovcnt = out_num;
+        }
+
+        sent = qemu_sendv_packet_batch_async(nc, pkts, count,
+                                             virtio_net_tx_complete);
+
+        /* Queued packets have been copied, restore the guest's iovecs */
+        for (i = 0; i < count; i++) {
+            iov_discard_undo(&undo[i]);
+        }
+
+        if (sent) {
+            virtqueue_push_batch(q->tx_vq, elems, lens, sent);
+            virtio_notify(vdev, q->tx_vq);
+            for (i = 0; i < sent; i++) {
+                virtqueue_element_free(elems[i]);
+            }
+            num_packets += sent;
+        }
+
+        if (sent < count) {
+            /* elems[sent] is in flight, give the rest back to the guest */
+            for (i = count - 1; i > sent; i--) {
+                virtqueue_unpop(q->tx_vq, elems[i], 0);
+                virtqueue_element_free(elems[i]);
+            }
+            virtio_queue_set_notification(q->tx_vq, 0);
+            q->async_tx.elem = elems[sent];
+            return -EBUSY;
+        }
+    }
+    return num_packets;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
@@ -2734,6 +3311,10 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
+    if (virtio_net_tx_can_batch(n)) {
+        return virtio_net_flush_tx_batch(q);
+    }
+
     for (;;) {
         ssize_t ret;
         unsigned int out_num;
@@ -2750,16 +3331,18 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
+            virtqueue_element_free(elem);
             return -EINVAL;
         }
 
+        virtio_net_flow_learn(n, queue_index, out_sg, out_num);
+
         if (n->has_vnet_hdr) {
             if (iov_to_buf(out_sg, out_num, 0, &vhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
+                virtqueue_element_free(elem);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -2804,7 +3387,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
         virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        virtqueue_element_free(elem);
 
         if (++num_packets >= n->tx_burst) {
             break;
@@ -2991,6 +3574,13 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                                                   &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    if (n->net_conf.gro) {
+        n->vqs[index].gro = net_gro_new(virtio_net_gro_deliver, &n->vqs[index]);
+        n->vqs[index].gro_bh =
+            qemu_bh_new_guarded(virtio_net_gro_bh, &n->vqs[index],
+                                &DEVICE(vdev)->mem_reentrancy_guard);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -3012,6 +3602,12 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    if (q->gro) {
+        qemu_bh_delete(q->gro_bh);
+        q->gro_bh = NULL;
+        net_gro_free(q->gro);
+        q->gro = NULL;
+    }
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
@@ -3407,6 +4003,10 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .flow_rule_add = virtio_net_flow_rule_add,
+    .flow_rule_del = virtio_net_flow_rule_del,
+    .flow_steering_set = virtio_net_flow_steering_set,
+    .query_flow_steering = virtio_net_query_flow_steering,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3807,10 +4407,18 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
             (uint8_t *)&netcfg, 0, ETH_ALEN, VHOST_SET_CONFIG_TYPE_FRONTEND);
     }
     QTAILQ_INIT(&n->rsc_chains);
+    QTAILQ_INIT(&n->flow_steering.rules);
     n->qdev = dev;
 
     net_rx_pkt_init(&n->rx_pkt);
 
+    if (n->net_conf.gro) {
+        n->gro_vmstate = qdev_add_vm_change_state_handler_full(dev,
+                                            virtio_net_gro_vm_state_change,
+                                            virtio_net_gro_vm_state_prepare,
+                                            n);
+    }
+
     if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS)) {
         virtio_net_load_ebpf(n, errp);
     }
@@ -3829,6 +4437,11 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
 
+    if (n->gro_vmstate) {
+        qemu_del_vm_change_state_handler(n->gro_vmstate);
+        n->gro_vmstate = NULL;
+    }
+
     g_free(n->netclient_name);
     n->netclient_name = NULL;
     g_free(n->netclient_type);
@@ -3855,6 +4468,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     g_free(n->vqs);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
+    virtio_net_flow_steering_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
     virtio_cleanup(vdev);
@@ -3995,6 +4609,7 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("gro", VirtIONet, net_conf.gro, false),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -40,6 +40,7 @@
  *              sriov_vi_flexible=<N[optional]> \
  *              sriov_max_vi_per_vf=<N[optional]> \
  *              sriov_max_vq_per_vf=<N[optional]> \
+ *              iothread-vq-mapping=<mapping[optional]> \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -147,6 +148,15 @@
  *   a secondary controller. The default 0 resolves to
  *   `(sriov_vq_flexible / sriov_max_vfs)`.
  *
+ * - `iothread-vq-mapping`
+ *   Assigns I/O queue pairs to IOThreads, in the same format as the
+ *   virtio-blk property of the same name. Entry `vqs` index N denotes I/O
+ *   queue pair N + 1; without `vqs`, queue pairs are assigned round-robin.
+ *   The admin queue is always processed in the main loop, as are I/O
+ *   queues created while MSI-X is disabled. With KVM, MSI-X interrupts of
+ *   queues in an IOThread are injected from the IOThread through an irqfd.
+ *   Zoned and FDP namespaces are not supported with this parameter.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -194,15 +204,20 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/units.h"
 #include "qemu/range.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "block/aio-wait.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/kvm.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pcie_sriov.h"
+#include "hw/qdev-properties-system.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "migration/vmstate.h"
 
 #include "nvme.h"
@@ -622,11 +637,13 @@ static int nvme_check_cqid(NvmeCtrl *n, uint16_t cqid)
 
 static void nvme_inc_cq_tail(NvmeCQueue *cq)
 {
-    cq->tail++;
-    if (cq->tail >= cq->size) {
-        cq->tail = 0;
+    uint32_t tail = cq->tail + 1;
+
+    if (tail >= cq->size) {
+        tail = 0;
         cq->phase = !cq->phase;
     }
+    qatomic_set(&cq->tail, tail);
 }
 
 static void nvme_inc_sq_head(NvmeSQueue *sq)
@@ -634,14 +651,25 @@ static void nvme_inc_sq_head(NvmeSQueue *sq)
     sq->head = (sq->head + 1) % sq->size;
 }
 
+/*
+ * The head of a completion queue and the tail of a submission queue are
+ * written by doorbell writes, which for queues in an IOThread run in the
+ * vCPU thread, and read by the queue's AioContext.
+ */
 static uint8_t nvme_cq_full(NvmeCQueue *cq)
 {
-    return (cq->tail + 1) % cq->size == cq->head;
+    return (qatomic_read(&cq->tail) + 1) % cq->size ==
+           qatomic_read(&cq->head);
+}
+
+static bool nvme_cq_empty(NvmeCQueue *cq)
+{
+    return qatomic_read(&cq->tail) == qatomic_read(&cq->head);
 }
 
 static uint8_t nvme_sq_empty(NvmeSQueue *sq)
 {
-    return sq->head == sq->tail;
+    return sq->head == qatomic_read(&sq->tail);
 }
 
 static void nvme_irq_check(NvmeCtrl *n)
@@ -693,6 +721,225 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static inline bool nvme_cq_in_iothread(NvmeCQueue *cq)
+{
+    return cq->ctx != qemu_get_aio_context();
+}
+
+/*
+ * Without an irqfd, interrupts of completion queues in an IOThread are
+ * delivered from the main loop, where the BQL is held.  Such queues are
+ * only created while MSI-X is enabled, but the guest may fall back to
+ * pin-based interrupts later, so also keep their contribution to
+ * cq_pending up to date here: the bottom half runs after new entries are
+ * posted, with @irq_notify set, and after the guest consumed all entries.
+ */
+static void nvme_cq_irq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+    bool notify = qatomic_xchg(&cq->irq_notify, false);
+    bool pending = !nvme_cq_empty(cq);
+
+    if (cq->irq_enabled && pending != cq->irq_pending) {
+        cq->irq_pending = pending;
+        if (pending) {
+            n->cq_pending++;
+        } else {
+            n->cq_pending--;
+        }
+    }
+
+    if (pending) {
+        if (notify) {
+            nvme_irq_assert(n, cq);
+        }
+    } else {
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+/*
+ * With KVM, completion queues in an IOThread signal MSI-X interrupts
+ * through an irqfd, without a round trip through the main loop.  The
+ * irqfd is detached from its MSI route while the vector is masked; KVM
+ * injects a signal that arrived meanwhile when it is attached again, and
+ * nvme_msix_vector_poll() reports it in the PBA until then.
+ */
+static int nvme_cq_attach_irqfd(NvmeCQueue *cq)
+{
+    int ret;
+
+    ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                             NULL, cq->virq);
+    if (ret < 0) {
+        return ret;
+    }
+    cq->irqfd_attached = true;
+    qatomic_set(&cq->irqfd, true);
+
+    return 0;
+}
+
+static void nvme_cq_detach_irqfd(NvmeCQueue *cq)
+{
+    if (cq->irqfd_attached) {
+        kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &cq->irq_notifier,
+                                              cq->virq);
+        cq->irqfd_attached = false;
+    }
+}
+
+static void nvme_cq_init_irqfd(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    PCIDevice *pci = PCI_DEVICE(n);
+    KVMRouteChange c;
+    int ret;
+
+    if (!pci->msix_vector_use_notifier || !cq->irq_enabled) {
+        return;
+    }
+
+    if (event_notifier_init(&cq->irq_notifier, 0)) {
+        return;
+    }
+
+    c = kvm_irqchip_begin_route_changes(kvm_state);
+    ret = kvm_irqchip_add_msi_route(&c, cq->vector, pci);
+    if (ret < 0) {
+        event_notifier_cleanup(&cq->irq_notifier);
+        return;
+    }
+    kvm_irqchip_commit_route_changes(&c);
+    cq->virq = ret;
+
+    if (msix_is_masked(pci, cq->vector)) {
+        qatomic_set(&cq->irqfd, true);
+    } else if (nvme_cq_attach_irqfd(cq) < 0) {
+        kvm_irqchip_release_virq(kvm_state, cq->virq);
+        event_notifier_cleanup(&cq->irq_notifier);
+        cq->virq = -1;
+    }
+}
+
+static void nvme_cq_cleanup_irqfd(NvmeCQueue *cq)
+{
+    if (cq->virq < 0) {
+        return;
+    }
+
+    nvme_cq_detach_irqfd(cq);
+    kvm_irqchip_release_virq(kvm_state, cq->virq);
+    event_notifier_cleanup(&cq->irq_notifier);
+    cq->virq = -1;
+    cq->irqfd = false;
+}
+
+static int nvme_msix_vector_use(PCIDevice *pci, unsigned int vector,
+                                MSIMessage msg)
+{
+    NvmeCtrl *n = NVME(pci);
+    NvmeCQueue *cq;
+    int i, ret;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (cq && cq->virq >= 0 && cq->vector == vector) {
+            ret = kvm_irqchip_update_msi_route(kvm_state, cq->virq, msg, pci);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    kvm_irqchip_commit_routes(kvm_state);
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (cq && cq->virq >= 0 && cq->vector == vector &&
+            !cq->irqfd_attached) {
+            ret = nvme_cq_attach_irqfd(cq);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void nvme_msix_vector_release(PCIDevice *pci, unsigned int vector)
+{
+    NvmeCtrl *n = NVME(pci);
+    NvmeCQueue *cq;
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (!cq || cq->virq < 0 || cq->vector != vector) {
+            continue;
+        }
+
+        nvme_cq_detach_irqfd(cq);
+
+        /*
+         * The guest disabled MSI-X rather than masking the vector; go
+         * back to the bottom half, which raises the pin-based interrupt
+         * if entries are still pending.
+         */
+        if (!msix_enabled(pci)) {
+            qatomic_set(&cq->irqfd, false);
+            event_notifier_test_and_clear(&cq->irq_notifier);
+            qatomic_set(&cq->irq_notify, true);
+            qemu_bh_schedule(cq->irq_bh);
+        }
+    }
+}
+
+static void nvme_msix_vector_poll(PCIDevice *pci, unsigned int vector_start,
+                                  unsigned int vector_end)
+{
+    NvmeCtrl *n = NVME(pci);
+    NvmeCQueue *cq;
+    int i;
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        cq = n->cq[i];
+        if (!cq || cq->virq < 0 || cq->vector < vector_start ||
+            cq->vector >= vector_end || !msix_is_masked(pci, cq->vector)) {
+            continue;
+        }
+
+        if (event_notifier_test_and_clear(&cq->irq_notifier)) {
+            msix_set_pending(pci, cq->vector);
+        }
+    }
+}
+
+static QEMUBH *nvme_queue_bh_new(NvmeCtrl *n, AioContext *ctx,
+                                 QEMUBHFunc *cb, void *opaque)
+{
+    if (ctx == qemu_get_aio_context()) {
+        return qemu_bh_new_guarded(cb, opaque,
+                                   &DEVICE(n)->mem_reentrancy_guard);
+    }
+
+    /*
+     * The device's reentrancy guard is not thread-safe, and engaging it
+     * from an IOThread would make concurrent MMIO from vCPUs fail.
+     */
+    return aio_bh_new(ctx, cb, opaque);
+}
+
+static void nvme_queue_set_notifier(AioContext *ctx, EventNotifier *e,
+                                    EventNotifierHandler *handler)
+{
+    if (ctx == qemu_get_aio_context()) {
+        event_notifier_set_handler(e, handler);
+    } else {
+        aio_set_event_notifier(ctx, e, handler, NULL, NULL);
+    }
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -1468,18 +1715,23 @@ static inline void nvme_blk_write(BlockBackend *blk, int64_t offset,
 
 static void nvme_update_cq_eventidx(const NvmeCQueue *cq)
 {
-    trace_pci_nvme_update_cq_eventidx(cq->cqid, cq->head);
+    uint32_t head = qatomic_read(&cq->head);
+
+    trace_pci_nvme_update_cq_eventidx(cq->cqid, head);
 
-    stl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->ei_addr, cq->head,
+    stl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->ei_addr, head,
                    MEMTXATTRS_UNSPECIFIED);
 }
 
 static void nvme_update_cq_head(NvmeCQueue *cq)
 {
-    ldl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->db_addr, &cq->head,
+    uint32_t head;
+
+    ldl_le_pci_dma(PCI_DEVICE(cq->ctrl), cq->db_addr, &head,
                    MEMTXATTRS_UNSPECIFIED);
+    qatomic_set(&cq->head, head);
 
-    trace_pci_nvme_update_cq_head(cq->cqid, cq->head);
+    trace_pci_nvme_update_cq_head(cq->cqid, head);
 }
 
 static void nvme_post_cqes(void *opaque)
@@ -1521,7 +1773,24 @@ static void nvme_post_cqes(void *opaque)
         nvme_sg_unmap(&req->sg);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
-    if (cq->tail != cq->head) {
+    if (!nvme_cq_empty(cq)) {
+        if (nvme_cq_in_iothread(cq)) {
+            /*
+             * Order the tail update before reading @irqfd; pairs with
+             * qemu_bh_schedule() in nvme_msix_vector_release().
+             */
+            smp_mb();
+            if (qatomic_read(&cq->irqfd)) {
+                trace_pci_nvme_irq_irqfd(cq->cqid, cq->vector);
+                event_notifier_set(&cq->irq_notifier);
+                return;
+            }
+
+            qatomic_set(&cq->irq_notify, true);
+            qemu_bh_schedule(cq->irq_bh);
+            return;
+        }
+
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
         }
@@ -4497,12 +4766,16 @@ static void nvme_cq_notifier(EventNotifier *e)
 
     nvme_update_cq_head(cq);
 
-    if (cq->tail == cq->head) {
-        if (cq->irq_enabled) {
-            n->cq_pending--;
-        }
+    if (nvme_cq_empty(cq)) {
+        if (nvme_cq_in_iothread(cq)) {
+            qemu_bh_schedule(cq->irq_bh);
+        } else {
+            if (cq->irq_enabled) {
+                n->cq_pending--;
+            }
 
-        nvme_irq_deassert(n, cq);
+            nvme_irq_deassert(n, cq);
+        }
     }
 
     qemu_bh_schedule(cq->bh);
@@ -4519,7 +4792,7 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    nvme_queue_set_notifier(cq->ctx, &cq->notifier, nvme_cq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4548,7 +4821,7 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    nvme_queue_set_notifier(sq->ctx, &sq->notifier, nvme_sq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
@@ -4564,7 +4837,7 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
+        nvme_queue_set_notifier(sq->ctx, &sq->notifier, NULL);
         event_notifier_cleanup(&sq->notifier);
     }
     g_free(sq->io_req);
@@ -4573,12 +4846,72 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     }
 }
 
+/* Context: the AioContext of @sq */
+static void nvme_sq_stop_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    if (sq->ioeventfd_enabled) {
+        aio_set_event_notifier(sq->ctx, &sq->notifier, NULL, NULL, NULL);
+    }
+    qemu_bh_cancel(sq->bh);
+}
+
+/* Context: the AioContext of @cq */
+static void nvme_cq_stop_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    if (cq->ioeventfd_enabled) {
+        aio_set_event_notifier(cq->ctx, &cq->notifier, NULL, NULL, NULL);
+    }
+    qemu_bh_cancel(cq->bh);
+}
+
+/* Context: the AioContext of @sq */
+static void nvme_unlink_sq(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeCtrl *n = sq->ctrl;
+    NvmeRequest *r, *next;
+    NvmeCQueue *cq;
+
+    if (nvme_check_cqid(n, sq->cqid)) {
+        return;
+    }
+
+    cq = n->cq[sq->cqid];
+    QTAILQ_REMOVE(&cq->sq_list, sq, entry);
+
+    nvme_post_cqes(cq);
+    QTAILQ_FOREACH_SAFE(r, &cq->req_list, entry, next) {
+        if (r->sq == sq) {
+            QTAILQ_REMOVE(&cq->req_list, r, entry);
+            QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
+        }
+    }
+}
+
+static void nvme_drain_namespaces(NvmeCtrl *n)
+{
+    NvmeNamespace *ns;
+    int i;
+
+    for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
+        ns = nvme_ns(n, i);
+        if (!ns) {
+            continue;
+        }
+
+        nvme_ns_drain(ns);
+    }
+}
+
 static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
-    NvmeRequest *r, *next;
+    NvmeRequest *r;
     NvmeSQueue *sq;
-    NvmeCQueue *cq;
     uint16_t qid = le16_to_cpu(c->qid);
 
     if (unlikely(!qid || nvme_check_sqid(n, qid))) {
@@ -4589,6 +4922,19 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    if (sq->ctx != qemu_get_aio_context()) {
+        /*
+         * Requests of a queue in an IOThread complete there; stop fetching
+         * new commands and let the outstanding ones finish instead of
+         * cancelling them from this thread.
+         */
+        aio_wait_bh_oneshot(sq->ctx, nvme_sq_stop_bh, sq);
+        nvme_drain_namespaces(n);
+        aio_wait_bh_oneshot(sq->ctx, nvme_unlink_sq, sq);
+        nvme_free_sq(sq, n);
+        return NVME_SUCCESS;
+    }
+
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         r = QTAILQ_FIRST(&sq->out_req_list);
         assert(r->aiocb);
@@ -4597,19 +4943,7 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
 
     assert(QTAILQ_EMPTY(&sq->out_req_list));
 
-    if (!nvme_check_cqid(n, sq->cqid)) {
-        cq = n->cq[sq->cqid];
-        QTAILQ_REMOVE(&cq->sq_list, sq, entry);
-
-        nvme_post_cqes(cq);
-        QTAILQ_FOREACH_SAFE(r, &cq->req_list, entry, next) {
-            if (r->sq == sq) {
-                QTAILQ_REMOVE(&cq->req_list, r, entry);
-                QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
-            }
-        }
-    }
-
+    nvme_unlink_sq(sq);
     nvme_free_sq(sq, n);
     return NVME_SUCCESS;
 }
@@ -4635,8 +4969,12 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    assert(n->cq[cqid]);
+    cq = n->cq[cqid];
+
+    /* A submission queue is processed where its completion queue is. */
+    sq->ctx = cq->ctx;
+    sq->bh = nvme_queue_bh_new(n, sq->ctx, nvme_process_sq, sq);
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -4649,8 +4987,6 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
 
-    assert(n->cq[cqid]);
-    cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
 }
@@ -4702,12 +5038,14 @@ struct nvme_stats {
 
 static void nvme_set_blk_stats(NvmeNamespace *ns, struct nvme_stats *stats)
 {
-    BlockAcctStats *s = blk_get_stats(ns->blkconf.blk);
+    BlockAcctCounters c;
+
+    block_acct_get_counters(blk_get_stats(ns->blkconf.blk), &c);
 
-    stats->units_read += s->nr_bytes[BLOCK_ACCT_READ];
-    stats->units_written += s->nr_bytes[BLOCK_ACCT_WRITE];
-    stats->read_commands += s->nr_ops[BLOCK_ACCT_READ];
-    stats->write_commands += s->nr_ops[BLOCK_ACCT_WRITE];
+    stats->units_read += c.nr_bytes[BLOCK_ACCT_READ];
+    stats->units_written += c.nr_bytes[BLOCK_ACCT_WRITE];
+    stats->read_commands += c.nr_ops[BLOCK_ACCT_READ];
+    stats->write_commands += c.nr_ops[BLOCK_ACCT_WRITE];
 }
 
 static uint16_t nvme_smart_info(NvmeCtrl *n, uint8_t rae, uint32_t buf_len,
@@ -5216,10 +5554,14 @@ static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 
     n->cq[cq->cqid] = NULL;
     qemu_bh_delete(cq->bh);
+    if (cq->irq_bh) {
+        qemu_bh_delete(cq->irq_bh);
+    }
+    nvme_cq_cleanup_irqfd(cq);
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
+        nvme_queue_set_notifier(cq->ctx, &cq->notifier, NULL);
         event_notifier_cleanup(&cq->notifier);
     }
     if (msix_enabled(pci)) {
@@ -5247,7 +5589,12 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
         return NVME_INVALID_QUEUE_DEL;
     }
 
-    if (cq->irq_enabled && cq->tail != cq->head) {
+    if (nvme_cq_in_iothread(cq)) {
+        aio_wait_bh_oneshot(cq->ctx, nvme_cq_stop_bh, cq);
+        if (cq->irq_pending) {
+            n->cq_pending--;
+        }
+    } else if (cq->irq_enabled && cq->tail != cq->head) {
         n->cq_pending--;
     }
 
@@ -5274,8 +5621,27 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
     cq->head = cq->tail = 0;
+    cq->irq_pending = false;
+    cq->irq_notify = false;
+    cq->virq = -1;
+    cq->irqfd = false;
+    cq->irqfd_attached = false;
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
+
+    /*
+     * I/O queue pairs may be processed in an IOThread if MSI-X is enabled;
+     * with pin-based interrupts the queue stays in the main loop.
+     */
+    cq->ctx = qemu_get_aio_context();
+    cq->irq_bh = NULL;
+    if (cqid && n->ioq_ctx && msix_enabled(pci)) {
+        cq->ctx = n->ioq_ctx[cqid - 1];
+        cq->irq_bh = qemu_bh_new_guarded(nvme_cq_irq_bh, cq,
+                                         &DEVICE(n)->mem_reentrancy_guard);
+        nvme_cq_init_irqfd(n, cq);
+    }
+
     if (n->dbbuf_enabled) {
         cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
         cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
@@ -5287,8 +5653,7 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->bh = nvme_queue_bh_new(n, cq->ctx, nvme_post_cqes, cq);
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -6417,7 +6782,9 @@ static uint16_t nvme_ns_attachment(NvmeCtrl *n, NvmeRequest *req)
                 return NVME_NS_PRIVATE | NVME_DNR;
             }
 
-            nvme_attach_ns(ctrl, ns);
+            if (nvme_attach_ns(ctrl, ns, NULL)) {
+                return NVME_INVALID_FIELD | NVME_DNR;
+            }
             nvme_select_iocs_ns(ctrl, ns);
 
             break;
@@ -6427,10 +6794,7 @@ static uint16_t nvme_ns_attachment(NvmeCtrl *n, NvmeRequest *req)
                 return NVME_NS_NOT_ATTACHED | NVME_DNR;
             }
 
-            ctrl->namespaces[nsid] = NULL;
-            ns->attached--;
-
-            nvme_update_dmrsl(ctrl);
+            nvme_detach_ns(ctrl, ns);
 
             break;
 
@@ -6989,18 +7353,23 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 
 static void nvme_update_sq_eventidx(const NvmeSQueue *sq)
 {
-    trace_pci_nvme_update_sq_eventidx(sq->sqid, sq->tail);
+    uint32_t tail = qatomic_read(&sq->tail);
 
-    stl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->ei_addr, sq->tail,
+    trace_pci_nvme_update_sq_eventidx(sq->sqid, tail);
+
+    stl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->ei_addr, tail,
                    MEMTXATTRS_UNSPECIFIED);
 }
 
 static void nvme_update_sq_tail(NvmeSQueue *sq)
 {
-    ldl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->db_addr, &sq->tail,
+    uint32_t tail;
+
+    ldl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->db_addr, &tail,
                    MEMTXATTRS_UNSPECIFIED);
+    qatomic_set(&sq->tail, tail);
 
-    trace_pci_nvme_update_sq_tail(sq->sqid, sq->tail);
+    trace_pci_nvme_update_sq_tail(sq->sqid, tail);
 }
 
 static void nvme_process_sq(void *opaque)
@@ -7091,16 +7460,28 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
 {
     PCIDevice *pci_dev = PCI_DEVICE(n);
     NvmeSecCtrlEntry *sctrl;
-    NvmeNamespace *ns;
     int i;
 
-    for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
-        ns = nvme_ns(n, i);
-        if (!ns) {
-            continue;
+    /*
+     * Stop queues in IOThreads from fetching commands before draining,
+     * and from posting completions after it.
+     */
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeSQueue *sq = n->sq[i];
+
+        if (sq && sq->ctx != qemu_get_aio_context()) {
+            aio_wait_bh_oneshot(sq->ctx, nvme_sq_stop_bh, sq);
         }
+    }
 
-        nvme_ns_drain(ns);
+    nvme_drain_namespaces(n);
+
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && nvme_cq_in_iothread(cq)) {
+            aio_wait_bh_oneshot(cq->ctx, nvme_cq_stop_bh, cq);
+        }
     }
 
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
@@ -7634,9 +8015,9 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
+        qatomic_set(&cq->head, new_head);
         if (!qid && n->dbbuf_enabled) {
-            stl_le_pci_dma(pci, cq->db_addr, cq->head, MEMTXATTRS_UNSPECIFIED);
+            stl_le_pci_dma(pci, cq->db_addr, new_head, MEMTXATTRS_UNSPECIFIED);
         }
         if (start_sqs) {
             NvmeSQueue *sq;
@@ -7646,12 +8027,16 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
             qemu_bh_schedule(cq->bh);
         }
 
-        if (cq->tail == cq->head) {
-            if (cq->irq_enabled) {
-                n->cq_pending--;
-            }
+        if (nvme_cq_empty(cq)) {
+            if (nvme_cq_in_iothread(cq)) {
+                qemu_bh_schedule(cq->irq_bh);
+            } else {
+                if (cq->irq_enabled) {
+                    n->cq_pending--;
+                }
 
-            nvme_irq_deassert(n, cq);
+                nvme_irq_deassert(n, cq);
+            }
         }
     } else {
         /* Submission queue doorbell write */
@@ -7694,7 +8079,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
-        sq->tail = new_tail;
+        qatomic_set(&sq->tail, new_tail);
         if (!qid && n->dbbuf_enabled) {
             /*
              * The spec states "the host shall also update the controller's
@@ -7709,7 +8094,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
              * including ones that run on Linux, are not updating Admin Queues,
              * so we can't trust reading it for an appropriate sq tail.
              */
-            stl_le_pci_dma(pci, sq->db_addr, sq->tail, MEMTXATTRS_UNSPECIFIED);
+            stl_le_pci_dma(pci, sq->db_addr, new_tail, MEMTXATTRS_UNSPECIFIED);
         }
 
         qemu_bh_schedule(sq->bh);
@@ -8157,6 +8542,15 @@ static bool nvme_init_pci(NvmeCtrl *n, PCIDevice *pci_dev, Error **errp)
 
     nvme_update_msixcap_ts(pci_dev, n->conf_msix_qsize);
 
+    if (n->ioq_ctx && msix_present(pci_dev) && kvm_msi_via_irqfd_enabled()) {
+        if (msix_set_vector_notifiers(pci_dev, nvme_msix_vector_use,
+                                      nvme_msix_vector_release,
+                                      nvme_msix_vector_poll)) {
+            warn_report("nvme: cannot use irqfd for IOThread completion "
+                        "queues");
+        }
+    }
+
     if (n->params.cmb_size_mb) {
         nvme_init_cmb(n, pci_dev);
     }
@@ -8318,16 +8712,52 @@ static int nvme_init_subsys(NvmeCtrl *n, Error **errp)
     return 0;
 }
 
-void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns)
+int nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
 {
     uint32_t nsid = ns->params.nsid;
     assert(nsid && nsid <= NVME_MAX_NAMESPACES);
 
+    /* Zone and reclaim unit state is not safe to update from IOThreads. */
+    if (n->ioq_ctx && (ns->params.zoned ||
+                       (ns->endgrp && ns->endgrp->fdp.enabled))) {
+        error_setg(errp, "zoned and FDP namespaces are not supported with "
+                   "iothread-vq-mapping");
+        return -1;
+    }
+
     n->namespaces[nsid] = ns;
     ns->attached++;
 
     n->dmrsl = MIN_NON_ZERO(n->dmrsl,
                             BDRV_REQUEST_MAX_BYTES / nvme_l2b(ns, 1));
+
+    return 0;
+}
+
+void nvme_detach_ns(NvmeCtrl *n, NvmeNamespace *ns)
+{
+    n->namespaces[ns->params.nsid] = NULL;
+    ns->attached--;
+
+    nvme_update_dmrsl(n);
+}
+
+static bool nvme_init_ioq_ctx(NvmeCtrl *n, Error **errp)
+{
+    if (!n->iothread_vq_mapping_list) {
+        return true;
+    }
+
+    /* Entry i holds the AioContext of I/O queue pair i + 1. */
+    n->ioq_ctx = g_new0(AioContext *, n->params.max_ioqpairs);
+    if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list, n->ioq_ctx,
+                                   n->params.max_ioqpairs, errp)) {
+        g_free(n->ioq_ctx);
+        n->ioq_ctx = NULL;
+        return false;
+    }
+
+    return true;
 }
 
 static void nvme_realize(PCIDevice *pci_dev, Error **errp)
@@ -8356,6 +8786,10 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (!nvme_init_ioq_ctx(n, errp)) {
+        return;
+    }
+
     qbus_init(&n->bus, sizeof(NvmeBus), TYPE_NVME_BUS, dev, dev->id);
 
     if (nvme_init_subsys(n, errp)) {
@@ -8376,7 +8810,9 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
             return;
         }
 
-        nvme_attach_ns(n, ns);
+        if (nvme_attach_ns(n, ns, errp)) {
+            return;
+        }
     }
 }
 
@@ -8403,6 +8839,11 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->sq);
     g_free(n->aer_reqs);
 
+    if (n->ioq_ctx) {
+        iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+        g_free(n->ioq_ctx);
+    }
+
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
     }
@@ -8415,6 +8856,9 @@ static void nvme_exit(PCIDevice *pci_dev)
         pcie_sriov_pf_exit(pci_dev);
     }
 
+    if (pci_dev->msix_vector_use_notifier) {
+        msix_unset_vector_notifiers(pci_dev);
+    }
     msix_uninit(pci_dev, &n->bar0, &n->bar0);
     memory_region_del_subregion(&n->bar0, &n->iomem);
 }
@@ -8437,6 +8881,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", NvmeCtrl,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
@@ -779,8 +779,9 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
             for (i = 0; i < ARRAY_SIZE(subsys->ctrls); i++) {
                 NvmeCtrl *ctrl = subsys->ctrls[i];
 
-                if (ctrl && ctrl != SUBSYS_SLOT_RSVD) {
-                    nvme_attach_ns(ctrl, ns);
+                if (ctrl && ctrl != SUBSYS_SLOT_RSVD &&
+                    nvme_attach_ns(ctrl, ns, errp)) {
+                    goto err_detach;
                 }
             }
 
@@ -789,7 +790,23 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
 
     }
 
-    nvme_attach_ns(n, ns);
+    if (nvme_attach_ns(n, ns, errp)) {
+        goto err;
+    }
+    return;
+
+err_detach:
+    while (i-- > 0) {
+        NvmeCtrl *ctrl = subsys->ctrls[i];
+
+        if (ctrl && ctrl != SUBSYS_SLOT_RSVD) {
+            nvme_detach_ns(ctrl, ns);
+        }
+    }
+err:
+    if (subsys) {
+        subsys->namespaces[nsid] = NULL;
+    }
 }
 
 static Property nvme_ns_props[] = {
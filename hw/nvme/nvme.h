@@ -21,6 +21,7 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "block/nvme.h"
 
@@ -485,6 +486,7 @@ typedef struct NvmeSQueue {
     uint64_t    db_addr;
     uint64_t    ei_addr;
     QEMUBH      *bh;
+    AioContext  *ctx;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
     NvmeRequest *io_req;
@@ -506,6 +508,14 @@ typedef struct NvmeCQueue {
     uint64_t    db_addr;
     uint64_t    ei_addr;
     QEMUBH      *bh;
+    AioContext  *ctx;
+    QEMUBH      *irq_bh;    /* only for queues in an IOThread */
+    EventNotifier irq_notifier; /* irqfd of queues in an IOThread */
+    int         virq;       /* KVM MSI route of irq_notifier, or -1 */
+    bool        irqfd;      /* MSI-X enabled, signal irq_notifier */
+    bool        irqfd_attached; /* irq_notifier attached to virq */
+    bool        irq_notify; /* entries were posted since irq_bh last ran */
+    bool        irq_pending; /* counted in cq_pending by irq_bh */
     EventNotifier notifier;
     bool        ioeventfd_enabled;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
@@ -597,6 +607,8 @@ typedef struct NvmeCtrl {
     NvmeNamespace   *namespaces[NVME_MAX_NAMESPACES + 1];
     NvmeSQueue      **sq;
     NvmeCQueue      **cq;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext      **ioq_ctx;  /* per I/O queue pair, NULL without IOThreads */
     NvmeSQueue      admin_sq;
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
@@ -683,7 +695,8 @@ static inline NvmeSecCtrlEntry *nvme_sctrl_for_cntlid(NvmeCtrl *n,
     return NULL;
 }
 
-void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns);
+int nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns, Error **errp);
+void nvme_detach_ns(NvmeCtrl *n, NvmeNamespace *ns);
 uint16_t nvme_bounce_data(NvmeCtrl *n, void *ptr, uint32_t len,
                           NvmeTxDirection dir, NvmeRequest *req);
 uint16_t nvme_bounce_mdata(NvmeCtrl *n, void *ptr, uint32_t len,
@@ -88,16 +88,30 @@ int nvme_subsys_register_ctrl(NvmeCtrl *n, Error **errp)
         return -1;
     }
 
-    subsys->ctrls[cntlid] = n;
-
     for (nsid = 1; nsid < ARRAY_SIZE(subsys->namespaces); nsid++) {
         NvmeNamespace *ns = subsys->namespaces[nsid];
-        if (ns && ns->params.shared && !ns->params.detached) {
-            nvme_attach_ns(n, ns);
+        if (ns && ns->params.shared && !ns->params.detached &&
+            nvme_attach_ns(n, ns, errp)) {
+            goto err_detach;
         }
     }
 
+    subsys->ctrls[cntlid] = n;
+
     return cntlid;
+
+err_detach:
+    while (--nsid > 0) {
+        NvmeNamespace *ns = nvme_ns(n, nsid);
+
+        if (ns) {
+            nvme_detach_ns(n, ns);
+        }
+    }
+    if (!pci_is_vf(&n->parent_obj)) {
+        nvme_subsys_unreserve_cntlids(n);
+    }
+    return -1;
 }
 
 void nvme_subsys_unregister_ctrl(NvmeSubsystem *subsys, NvmeCtrl *n)
@@ -21,10 +21,12 @@
 #include "qemu/defer-call.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/lockable.h"
 #include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/dma.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
@@ -47,7 +49,10 @@ typedef struct VirtIOSCSIReq {
     /* Used for two-stage request submission and TMFs deferred to BH */
     QTAILQ_ENTRY(VirtIOSCSIReq) next;
 
-    /* Used for cancellation of request during TMFs */
+    /*
+     * Used for cancellation of request during TMFs.  Requests may be cancelled
+     * in several AioContexts at once, so this is accessed atomically.
+     */
     int remaining;
 
     SCSIRequest *sreq;
@@ -102,6 +107,25 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
     g_free(req);
 }
 
+/*
+ * TMFs complete in the AioContext of the last request they cancel, so the
+ * control virtqueue can be accessed from several threads and needs a lock.
+ * The other virtqueues are only accessed from their own AioContext.
+ */
+static void virtio_scsi_vq_lock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (vq == s->parent_obj.ctrl_vq) {
+        qemu_mutex_lock(&s->ctrl_lock);
+    }
+}
+
+static void virtio_scsi_vq_unlock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (vq == s->parent_obj.ctrl_vq) {
+        qemu_mutex_unlock(&s->ctrl_lock);
+    }
+}
+
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
@@ -109,12 +133,14 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
     qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+    virtio_scsi_vq_lock(s, vq);
     virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+    virtio_scsi_vq_unlock(s, vq);
 
     if (req->sreq) {
         req->sreq->hba_private = NULL;
@@ -137,20 +163,23 @@ static void virtio_scsi_complete_req_bh(void *opaque)
 static void virtio_scsi_complete_req_from_main_loop(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
+    AioContext *ctx = s->vq_aio_context ? s->vq_aio_context[0] : NULL;
 
-    if (!s->ctx || s->ctx == qemu_get_aio_context()) {
+    if (!ctx || ctx == qemu_get_aio_context()) {
         /* No need to schedule a BH when there is no IOThread */
         virtio_scsi_complete_req(req);
     } else {
         /* Run request completion in the IOThread */
-        aio_wait_bh_oneshot(s->ctx, virtio_scsi_complete_req_bh, req);
+        aio_wait_bh_oneshot(ctx, virtio_scsi_complete_req_bh, req);
     }
 }
 
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
 {
     virtio_error(VIRTIO_DEVICE(req->dev), "wrong size for virtio-scsi headers");
+    virtio_scsi_vq_lock(req->dev, req->vq);
     virtqueue_detach_element(req->vq, &req->elem, 0);
+    virtio_scsi_vq_unlock(req->dev, req->vq);
     virtio_scsi_free_req(req);
 }
 
@@ -240,7 +269,9 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
     VirtIOSCSIReq *req;
 
+    virtio_scsi_vq_lock(s, vq);
     req = virtqueue_pop(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
+    virtio_scsi_vq_unlock(s, vq);
     if (!req) {
         return NULL;
     }
@@ -248,6 +279,25 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     return req;
 }
 
+/* Number of command requests taken from the virtqueue at a time */
+#define VIRTIO_SCSI_POP_BATCH 16
+
+/* Only for command virtqueues, which need no locking */
+static unsigned int virtio_scsi_pop_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                         VirtIOSCSIReq **reqs,
+                                         unsigned int max)
+{
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    unsigned int n, i;
+
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                            (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_scsi_init_req(s, vq, reqs[i]);
+    }
+    return n;
+}
+
 static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 {
     VirtIOSCSIReq *req = sreq->hba_private;
@@ -300,7 +350,7 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
                                                VirtIOSCSICancelNotifier,
                                                notifier);
 
-    if (--n->tmf_req->remaining == 0) {
+    if (qatomic_fetch_dec(&n->tmf_req->remaining) == 1) {
         VirtIOSCSIReq *req = n->tmf_req;
 
         trace_virtio_scsi_tmf_resp(virtio_scsi_get_lun(req->req.tmf.lun),
@@ -310,11 +360,137 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
     g_free(n);
 }
 
-static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
+static void virtio_scsi_tmf_cancel_req(VirtIOSCSIReq *tmf, SCSIRequest *r)
+{
+    VirtIOSCSICancelNotifier *notifier;
+
+    assert(r->ctx == qemu_get_current_aio_context());
+
+    /* Decremented in virtio_scsi_cancel_notify() */
+    qatomic_inc(&tmf->remaining);
+
+    notifier = g_new(VirtIOSCSICancelNotifier, 1);
+    notifier->notifier.notify = virtio_scsi_cancel_notify;
+    notifier->tmf_req = tmf;
+    scsi_req_cancel_async(r, &notifier->notifier);
+}
+
+typedef struct {
+    VirtIOSCSIReq *tmf;
+    SCSIDevice *d;
+} VirtIOSCSITMFData;
+
+/*
+ * Cancel the requests that a TMF applies to among those running in the
+ * current AioContext.  Requests can only be cancelled from there.
+ */
+static void virtio_scsi_do_tmf_aio_context_bh(void *opaque)
+{
+    g_autofree VirtIOSCSITMFData *data = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    VirtIOSCSIReq *tmf = data->tmf;
+    SCSIDevice *d = data->d;
+    bool match_tag = tmf->req.tmf.subtype == VIRTIO_SCSI_T_TMF_ABORT_TASK;
+    GList *reqs = NULL;
+    GList *elem;
+    SCSIRequest *r;
+
+    WITH_QEMU_LOCK_GUARD(&d->requests_lock) {
+        QTAILQ_FOREACH(r, &d->requests, next) {
+            VirtIOSCSIReq *cmd_req = r->hba_private;
+
+            if (r->ctx != ctx || !cmd_req) {
+                continue;
+            }
+            if (match_tag && cmd_req->req.cmd.tag != tmf->req.tmf.tag) {
+                continue;
+            }
+            scsi_req_ref(r);
+            reqs = g_list_prepend(reqs, r);
+        }
+    }
+
+    /* Cancellation may dequeue requests, so do it outside requests_lock */
+    for (elem = reqs; elem; elem = elem->next) {
+        virtio_scsi_tmf_cancel_req(tmf, elem->data);
+        scsi_req_unref(elem->data);
+    }
+    g_list_free(reqs);
+
+    /* Incremented by virtio_scsi_defer_tmf_to_aio_contexts() */
+    if (qatomic_fetch_dec(&tmf->remaining) == 1) {
+        trace_virtio_scsi_tmf_resp(virtio_scsi_get_lun(tmf->req.tmf.lun),
+                                   tmf->req.tmf.tag, tmf->resp.tmf.response);
+        virtio_scsi_complete_req(tmf);
+    }
+
+    blk_dec_in_flight(d->conf.blk);
+    object_unref(OBJECT(d));
+}
+
+/*
+ * Schedule the cancelling part of a TMF in every AioContext that runs one of
+ * the requests it applies to.  With iothread-vq-mapping, requests for the
+ * same LUN can be spread across several IOThreads.
+ *
+ * Each BH keeps the BlockBackend's in-flight counter incremented, so that
+ * dataplane stop and device reset, which drain all BlockBackends, wait for
+ * them before the control virtqueue is torn down.
+ */
+static void virtio_scsi_defer_tmf_to_aio_contexts(VirtIOSCSIReq *tmf,
+                                                  SCSIDevice *d,
+                                                  bool match_tag)
+{
+    g_autoptr(GHashTable) aio_contexts = g_hash_table_new(NULL, NULL);
+    GHashTableIter iter;
+    gpointer key;
+    SCSIRequest *r;
+
+    WITH_QEMU_LOCK_GUARD(&d->requests_lock) {
+        QTAILQ_FOREACH(r, &d->requests, next) {
+            VirtIOSCSIReq *cmd_req = r->hba_private;
+
+            if (!cmd_req) {
+                continue;
+            }
+            if (match_tag && cmd_req->req.cmd.tag != tmf->req.tmf.tag) {
+                continue;
+            }
+            g_hash_table_add(aio_contexts, r->ctx);
+        }
+    }
+
+    g_hash_table_iter_init(&iter, aio_contexts);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        VirtIOSCSITMFData *data = g_new(VirtIOSCSITMFData, 1);
+
+        data->tmf = tmf;
+        data->d = d;
+        object_ref(OBJECT(d));
+        blk_inc_in_flight(d->conf.blk);
+
+        /* Decremented in virtio_scsi_do_tmf_aio_context_bh() */
+        qatomic_inc(&tmf->remaining);
+        aio_bh_schedule_oneshot(key, virtio_scsi_do_tmf_aio_context_bh, data);
+    }
+}
+
+/* Returns true if any request of @d matches the TMF */
+static bool virtio_scsi_tmf_has_req(VirtIOSCSIReq *tmf, SCSIDevice *d,
+                                    bool match_tag)
 {
-    if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
-        assert(blk_get_aio_context(d->conf.blk) == s->ctx);
+    SCSIRequest *r;
+
+    QEMU_LOCK_GUARD(&d->requests_lock);
+    QTAILQ_FOREACH(r, &d->requests, next) {
+        VirtIOSCSIReq *cmd_req = r->hba_private;
+
+        if (cmd_req &&
+            (!match_tag || cmd_req->req.cmd.tag == tmf->req.tmf.tag)) {
+            return true;
+        }
     }
+    return false;
 }
 
 static void virtio_scsi_do_one_tmf_bh(VirtIOSCSIReq *req)
@@ -433,10 +609,9 @@ static void virtio_scsi_defer_tmf_to_bh(VirtIOSCSIReq *req)
 static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     SCSIDevice *d = virtio_scsi_device_get(s, req->req.tmf.lun);
-    SCSIRequest *r, *next;
+    bool match_tag;
     int ret = 0;
 
-    virtio_scsi_ctx_check(s, d);
     /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
     req->resp.tmf.response = VIRTIO_SCSI_S_OK;
 
@@ -452,51 +627,29 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
     switch (req->req.tmf.subtype) {
     case VIRTIO_SCSI_T_TMF_ABORT_TASK:
-    case VIRTIO_SCSI_T_TMF_QUERY_TASK:
+    case VIRTIO_SCSI_T_TMF_ABORT_TASK_SET:
+    case VIRTIO_SCSI_T_TMF_CLEAR_TASK_SET:
         if (!d) {
             goto fail;
         }
         if (d->lun != virtio_scsi_get_lun(req->req.tmf.lun)) {
             goto incorrect_lun;
         }
-        QTAILQ_FOREACH_SAFE(r, &d->requests, next, next) {
-            VirtIOSCSIReq *cmd_req = r->hba_private;
-            if (cmd_req && cmd_req->req.cmd.tag == req->req.tmf.tag) {
-                break;
-            }
-        }
-        if (r) {
-            /*
-             * Assert that the request has not been completed yet, we
-             * check for it in the loop above.
-             */
-            assert(r->hba_private);
-            if (req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK) {
-                /* "If the specified command is present in the task set, then
-                 * return a service response set to FUNCTION SUCCEEDED".
-                 */
-                req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
-            } else {
-                VirtIOSCSICancelNotifier *notifier;
-
-                req->remaining = 1;
-                notifier = g_new(VirtIOSCSICancelNotifier, 1);
-                notifier->tmf_req = req;
-                notifier->notifier.notify = virtio_scsi_cancel_notify;
-                scsi_req_cancel_async(r, &notifier->notifier);
-                ret = -EINPROGRESS;
-            }
-        }
-        break;
 
-    case VIRTIO_SCSI_T_TMF_LOGICAL_UNIT_RESET:
-    case VIRTIO_SCSI_T_TMF_I_T_NEXUS_RESET:
-        virtio_scsi_defer_tmf_to_bh(req);
-        ret = -EINPROGRESS;
+        /* Add 1 to "remaining" until virtio_scsi_do_tmf returns.
+         * This way, if the bus starts calling back to the notifiers
+         * even before we finish, virtio_scsi_cancel_notify will not
+         * complete the TMF too early.
+         */
+        req->remaining = 1;
+        match_tag = req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_ABORT_TASK;
+        virtio_scsi_defer_tmf_to_aio_contexts(req, d, match_tag);
+        if (qatomic_fetch_dec(&req->remaining) > 1) {
+            ret = -EINPROGRESS;
+        }
         break;
 
-    case VIRTIO_SCSI_T_TMF_ABORT_TASK_SET:
-    case VIRTIO_SCSI_T_TMF_CLEAR_TASK_SET:
+    case VIRTIO_SCSI_T_TMF_QUERY_TASK:
     case VIRTIO_SCSI_T_TMF_QUERY_TASK_SET:
         if (!d) {
             goto fail;
@@ -505,36 +658,21 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
             goto incorrect_lun;
         }
 
-        /* Add 1 to "remaining" until virtio_scsi_do_tmf returns.
-         * This way, if the bus starts calling back to the notifiers
-         * even before we finish the loop, virtio_scsi_cancel_notify
-         * will not complete the TMF too early.
+        /* "If the specified command is present in the task set, then
+         * return a service response set to FUNCTION SUCCEEDED".
          */
-        req->remaining = 1;
-        QTAILQ_FOREACH_SAFE(r, &d->requests, next, next) {
-            if (r->hba_private) {
-                if (req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK_SET) {
-                    /* "If there is any command present in the task set, then
-                     * return a service response set to FUNCTION SUCCEEDED".
-                     */
-                    req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
-                    break;
-                } else {
-                    VirtIOSCSICancelNotifier *notifier;
-
-                    req->remaining++;
-                    notifier = g_new(VirtIOSCSICancelNotifier, 1);
-                    notifier->notifier.notify = virtio_scsi_cancel_notify;
-                    notifier->tmf_req = req;
-                    scsi_req_cancel_async(r, &notifier->notifier);
-                }
-            }
-        }
-        if (--req->remaining > 0) {
-            ret = -EINPROGRESS;
+        match_tag = req->req.tmf.subtype == VIRTIO_SCSI_T_TMF_QUERY_TASK;
+        if (virtio_scsi_tmf_has_req(req, d, match_tag)) {
+            req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_SUCCEEDED;
         }
         break;
 
+    case VIRTIO_SCSI_T_TMF_LOGICAL_UNIT_RESET:
+    case VIRTIO_SCSI_T_TMF_I_T_NEXUS_RESET:
+        virtio_scsi_defer_tmf_to_bh(req);
+        ret = -EINPROGRESS;
+        break;
+
     case VIRTIO_SCSI_T_TMF_CLEAR_ACA:
     default:
         req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_REJECTED;
@@ -626,7 +764,7 @@ static void virtio_scsi_handle_ctrl_vq(VirtIOSCSI *s, VirtQueue *vq)
  */
 static bool virtio_scsi_defer_to_dataplane(VirtIOSCSI *s)
 {
-    if (!s->ctx || s->dataplane_started) {
+    if (!s->vq_aio_context || s->dataplane_started) {
         return false;
     }
 
@@ -802,7 +940,6 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
         virtio_scsi_complete_cmd_req(req);
         return -ENOENT;
     }
-    virtio_scsi_ctx_check(s, d);
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
                              req->req.cmd.cdb, vs->cdb_size, req);
@@ -833,7 +970,9 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSIReq *batch[VIRTIO_SCSI_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, n;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -844,11 +983,17 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
+        while ((n = virtio_scsi_pop_reqs(s, vq, batch, ARRAY_SIZE(batch)))) {
+            for (i = 0; i < n; i++) {
+                req = batch[i];
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    break;
+                }
+            }
+            if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
                 while (!QTAILQ_EMPTY(&reqs)) {
                     req = QTAILQ_FIRST(&reqs);
@@ -858,6 +1003,12 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
                     virtqueue_detach_element(req->vq, &req->elem, 0);
                     virtio_scsi_free_req(req);
                 }
+                /* Requests after the bad one were popped but not parsed */
+                for (i++; i < n; i++) {
+                    virtqueue_detach_element(vq, &batch[i]->elem, 0);
+                    virtio_scsi_free_req(batch[i]);
+                }
+                break;
             }
         }
 
@@ -1063,15 +1214,28 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     VirtIODevice *vdev = VIRTIO_DEVICE(hotplug_dev);
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
     SCSIDevice *sd = SCSI_DEVICE(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
     int ret;
 
-    if (s->ctx && !s->dataplane_fenced) {
+    if (s->vq_aio_context && !s->dataplane_fenced) {
+        AioContext *ctx = s->vq_aio_context[VIRTIO_SCSI_VQ_NUM_FIXED];
+
         if (blk_op_is_blocked(sd->conf.blk, BLOCK_OP_TYPE_DATAPLANE, errp)) {
             return;
         }
-        ret = blk_set_aio_context(sd->conf.blk, s->ctx, errp);
-        if (ret < 0) {
-            return;
+
+        if (vs->conf.iothread_vq_mapping_list) {
+            /*
+             * The LUN is accessed from several AioContexts anyway.  Prefer
+             * the first command virtqueue's, but I/O still works if other
+             * users keep the BlockBackend elsewhere.
+             */
+            blk_set_aio_context(sd->conf.blk, ctx, NULL);
+        } else {
+            ret = blk_set_aio_context(sd->conf.blk, ctx, errp);
+            if (ret < 0) {
+                return;
+            }
         }
     }
 
@@ -1107,7 +1271,7 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
 
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
 
-    if (s->ctx) {
+    if (s->vq_aio_context) {
         /* If other users keep the BlockBackend in the iothread, that's ok */
         blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
     }
@@ -1141,7 +1305,7 @@ static void virtio_scsi_drained_begin(SCSIBus *bus)
 
     for (uint32_t i = 0; i < total_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+        virtio_queue_aio_detach_host_notifier(vq, s->vq_aio_context[i]);
     }
 }
 
@@ -1167,10 +1331,12 @@ static void virtio_scsi_drained_end(SCSIBus *bus)
 
     for (uint32_t i = 0; i < total_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
         if (vq == vs->event_vq) {
-            virtio_queue_aio_attach_host_notifier_no_poll(vq, s->ctx);
+            virtio_queue_aio_attach_host_notifier_no_poll(vq, ctx);
         } else {
-            virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+            virtio_queue_aio_attach_host_notifier(vq, ctx);
         }
     }
 }
@@ -1241,6 +1407,7 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
 
     QTAILQ_INIT(&s->tmf_bh_list);
     qemu_mutex_init(&s->tmf_bh_lock);
+    qemu_mutex_init(&s->ctrl_lock);
 
     virtio_scsi_common_realize(dev,
                                virtio_scsi_handle_ctrl,
@@ -1283,6 +1450,8 @@ static void virtio_scsi_device_unrealize(DeviceState *dev)
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
     virtio_scsi_common_unrealize(dev);
+    virtio_scsi_dataplane_cleanup(s);
+    qemu_mutex_destroy(&s->ctrl_lock);
     qemu_mutex_destroy(&s->tmf_bh_lock);
 }
 
@@ -1303,6 +1472,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOSCSI,
+            parent_obj.conf.iothread_vq_mapping_list),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -34,6 +34,7 @@ bool vhost_svq_valid_features(uint64_t features, Error **errp)
         switch (b) {
         case VIRTIO_F_ANY_LAYOUT:
         case VIRTIO_RING_F_EVENT_IDX:
+        case VIRTIO_F_RING_PACKED:
             continue;
 
         case VIRTIO_F_ACCESS_PLATFORM:
@@ -217,7 +218,108 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     return true;
 }
 
-static void vhost_svq_kick(VhostShadowVirtqueue *svq)
+static bool vhost_svq_add_packed(VhostShadowVirtqueue *svq,
+                                 const struct iovec *out_sg, size_t out_num,
+                                 const struct iovec *in_sg, size_t in_num,
+                                 unsigned *head)
+{
+    VhostShadowVringPacked *packed = &svq->vring_packed;
+    struct vring_packed_desc *descs = packed->desc;
+    uint16_t i = packed->next_avail_idx, head_idx = i;
+    uint16_t head_flags = 0;
+    bool wrap_counter = packed->avail_wrap_counter;
+    size_t n, num = out_num + in_num;
+    uint16_t id;
+    bool ok;
+    g_autofree hwaddr *sgs = g_new(hwaddr, MAX(num, 1));
+
+    /* We need some descriptors here */
+    if (unlikely(!num)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "Guest provided element with no descriptors");
+        return false;
+    }
+
+    ok = vhost_svq_translate_addr(svq, sgs, out_sg, out_num) &&
+         vhost_svq_translate_addr(svq, sgs + out_num, in_sg, in_num);
+    if (unlikely(!ok)) {
+        return false;
+    }
+
+    id = svq->free_head;
+    *head = id;
+
+    for (n = 0; n < num; n++) {
+        const struct iovec *iov = n < out_num ? &out_sg[n] :
+                                                &in_sg[n - out_num];
+        uint16_t flags = 0;
+
+        if (n >= out_num) {
+            flags |= VRING_DESC_F_WRITE;
+        }
+        if (n + 1 < num) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        if (wrap_counter) {
+            flags |= 1 << VRING_PACKED_DESC_F_AVAIL;
+        } else {
+            flags |= 1 << VRING_PACKED_DESC_F_USED;
+        }
+
+        descs[i].addr = cpu_to_le64(sgs[n]);
+        descs[i].len = cpu_to_le32(iov->iov_len);
+        descs[i].id = cpu_to_le16(id);
+        if (i == head_idx) {
+            head_flags = flags;
+        } else {
+            descs[i].flags = cpu_to_le16(flags);
+        }
+
+        if (++i >= svq->vring.num) {
+            i = 0;
+            wrap_counter = !wrap_counter;
+        }
+    }
+
+    svq->free_head = le16_to_cpu(svq->desc_next[id]);
+    packed->next_avail_idx = i;
+    packed->avail_wrap_counter = wrap_counter;
+
+    /*
+     * The head flags make the whole chain available, so write them after the
+     * rest of the descriptors.
+     */
+    smp_wmb();
+    descs[head_idx].flags = cpu_to_le16(head_flags);
+
+    return true;
+}
+
+static bool vhost_svq_packed_needs_kick(const VhostShadowVirtqueue *svq,
+                                        unsigned ndescs)
+{
+    const VhostShadowVringPacked *packed = &svq->vring_packed;
+    uint16_t flags = le16_to_cpu(packed->device->flags);
+    uint16_t off_wrap, event_idx, new, old;
+
+    if (flags != VRING_PACKED_EVENT_FLAG_DESC) {
+        return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+    }
+
+    off_wrap = le16_to_cpu(packed->device->off_wrap);
+    event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+    if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+        packed->avail_wrap_counter) {
+        /* The event is in the previous lap of the ring */
+        event_idx -= svq->vring.num;
+    }
+
+    new = packed->next_avail_idx;
+    old = new - ndescs;
+    return vring_need_event(event_idx, new, old);
+}
+
+static void vhost_svq_kick(VhostShadowVirtqueue *svq, unsigned ndescs)
 {
     bool needs_kick;
 
@@ -227,7 +329,9 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
      */
     smp_mb();
 
-    if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (svq->is_packed) {
+        needs_kick = vhost_svq_packed_needs_kick(svq, ndescs);
+    } else if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
         needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
     } else {
@@ -258,7 +362,13 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
         return -ENOSPC;
     }
 
-    ok = vhost_svq_add_split(svq, out_sg, out_num, in_sg, in_num, &qemu_head);
+    if (svq->is_packed) {
+        ok = vhost_svq_add_packed(svq, out_sg, out_num, in_sg, in_num,
+                                  &qemu_head);
+    } else {
+        ok = vhost_svq_add_split(svq, out_sg, out_num, in_sg, in_num,
+                                 &qemu_head);
+    }
     if (unlikely(!ok)) {
         return -EINVAL;
     }
@@ -266,7 +376,7 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    vhost_svq_kick(svq, ndescs);
     return 0;
 }
 
@@ -358,9 +468,26 @@ static void vhost_handle_guest_kick_notifier(EventNotifier *n)
     vhost_handle_guest_kick(svq);
 }
 
+static bool vhost_svq_more_used_packed(const VhostShadowVirtqueue *svq)
+{
+    const VhostShadowVringPacked *packed = &svq->vring_packed;
+    const struct vring_packed_desc *desc = &packed->desc[packed->last_used_idx];
+    uint16_t flags = le16_to_cpu(*(volatile uint16_t *)&desc->flags);
+    bool avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+    bool used = flags & (1 << VRING_PACKED_DESC_F_USED);
+
+    return avail == used && used == packed->used_wrap_counter;
+}
+
 static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
 {
-    uint16_t *used_idx = &svq->vring.used->idx;
+    uint16_t *used_idx;
+
+    if (svq->is_packed) {
+        return vhost_svq_more_used_packed(svq);
+    }
+
+    used_idx = &svq->vring.used->idx;
     if (svq->last_used_idx != svq->shadow_used_idx) {
         return true;
     }
@@ -381,7 +508,20 @@ static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
  */
 static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 {
-    if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (svq->is_packed) {
+        VhostShadowVringPacked *packed = &svq->vring_packed;
+
+        if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+            packed->driver->off_wrap = cpu_to_le16(packed->last_used_idx |
+                packed->used_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+            /* off_wrap must be valid before the device sees the flags */
+            smp_wmb();
+            packed->driver->flags = cpu_to_le16(VRING_PACKED_EVENT_FLAG_DESC);
+        } else {
+            packed->driver->flags =
+                cpu_to_le16(VRING_PACKED_EVENT_FLAG_ENABLE);
+        }
+    } else if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t *used_event = (uint16_t *)&svq->vring.avail->ring[svq->vring.num];
         *used_event = svq->shadow_used_idx;
     } else {
@@ -395,6 +535,12 @@ static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 
 static void vhost_svq_disable_notification(VhostShadowVirtqueue *svq)
 {
+    if (svq->is_packed) {
+        svq->vring_packed.driver->flags =
+            cpu_to_le16(VRING_PACKED_EVENT_FLAG_DISABLE);
+        return;
+    }
+
     /*
      * No need to disable notification in the event idx case, since used event
      * index is already an index too far away.
@@ -414,6 +560,52 @@ static uint16_t vhost_svq_last_desc_of_chain(const VhostShadowVirtqueue *svq,
     return i;
 }
 
+static VirtQueueElement *vhost_svq_get_buf_packed(VhostShadowVirtqueue *svq,
+                                                  uint32_t *len)
+{
+    VhostShadowVringPacked *packed = &svq->vring_packed;
+    const struct vring_packed_desc *desc;
+    uint16_t id, num;
+
+    if (!vhost_svq_more_used_packed(svq)) {
+        return NULL;
+    }
+
+    /* Only read the used descriptor after its flags say it is used */
+    smp_rmb();
+    desc = &packed->desc[packed->last_used_idx];
+    id = le16_to_cpu(desc->id);
+    *len = le32_to_cpu(desc->len);
+
+    if (unlikely(id >= svq->vring.num)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "Device %s says index %u is used",
+                      svq->vdev->name, id);
+        return NULL;
+    }
+
+    if (unlikely(!svq->desc_state[id].ndescs)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+            "Device %s says index %u is used, but it was not available",
+            svq->vdev->name, id);
+        return NULL;
+    }
+
+    /* The device writes one used descriptor for the whole chain */
+    num = svq->desc_state[id].ndescs;
+    svq->desc_state[id].ndescs = 0;
+    packed->last_used_idx += num;
+    if (packed->last_used_idx >= svq->vring.num) {
+        packed->last_used_idx -= svq->vring.num;
+        packed->used_wrap_counter = !packed->used_wrap_counter;
+    }
+
+    svq->desc_next[id] = svq->free_head;
+    svq->free_head = id;
+    svq->num_free += num;
+
+    return g_steal_pointer(&svq->desc_state[id].elem);
+}
+
 static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
                                            uint32_t *len)
 {
@@ -421,6 +613,10 @@ static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
     vring_used_elem_t used_elem;
     uint16_t last_used, last_used_chain, num;
 
+    if (svq->is_packed) {
+        return vhost_svq_get_buf_packed(svq, len);
+    }
+
     if (!vhost_svq_more_used(svq)) {
         return NULL;
     }
@@ -595,6 +791,15 @@ void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
 void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
                               struct vhost_vring_addr *addr)
 {
+    if (svq->is_packed) {
+        const VhostShadowVringPacked *packed = &svq->vring_packed;
+
+        addr->desc_user_addr = (uint64_t)(uintptr_t)packed->desc;
+        addr->avail_user_addr = (uint64_t)(uintptr_t)packed->driver;
+        addr->used_user_addr = (uint64_t)(uintptr_t)packed->device;
+        return;
+    }
+
     addr->desc_user_addr = (uint64_t)(uintptr_t)svq->vring.desc;
     addr->avail_user_addr = (uint64_t)(uintptr_t)svq->vring.avail;
     addr->used_user_addr = (uint64_t)(uintptr_t)svq->vring.used;
@@ -602,17 +807,30 @@ void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
 
 size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq)
 {
-    size_t desc_size = sizeof(vring_desc_t) * svq->vring.num;
-    size_t avail_size = offsetof(vring_avail_t, ring[svq->vring.num]) +
-                                                              sizeof(uint16_t);
+    size_t desc_size, avail_size;
+
+    if (svq->is_packed) {
+        desc_size = sizeof(struct vring_packed_desc) * svq->vring.num;
+        avail_size = sizeof(struct vring_packed_desc_event);
+    } else {
+        desc_size = sizeof(vring_desc_t) * svq->vring.num;
+        avail_size = offsetof(vring_avail_t, ring[svq->vring.num]) +
+                     sizeof(uint16_t);
+    }
 
     return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size());
 }
 
 size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
 {
-    size_t used_size = offsetof(vring_used_t, ring[svq->vring.num]) +
-                                                              sizeof(uint16_t);
+    size_t used_size;
+
+    if (svq->is_packed) {
+        used_size = sizeof(struct vring_packed_desc_event);
+    } else {
+        used_size = offsetof(vring_used_t, ring[svq->vring.num]) +
+                    sizeof(uint16_t);
+    }
     return ROUND_UP(used_size, qemu_real_host_page_size());
 }
 
@@ -658,6 +876,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
                      VirtQueue *vq, VhostIOVATree *iova_tree)
 {
     size_t desc_size;
+    void *driver_area, *device_area;
 
     event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
     svq->next_guest_avail_elem = NULL;
@@ -668,16 +887,35 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     svq->vq = vq;
     svq->iova_tree = iova_tree;
 
+    svq->is_packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
     svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
     svq->num_free = svq->vring.num;
-    svq->vring.desc = mmap(NULL, vhost_svq_driver_area_size(svq),
-                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
-                           -1, 0);
-    desc_size = sizeof(vring_desc_t) * svq->vring.num;
-    svq->vring.avail = (void *)((char *)svq->vring.desc + desc_size);
-    svq->vring.used = mmap(NULL, vhost_svq_device_area_size(svq),
-                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
-                           -1, 0);
+    driver_area = mmap(NULL, vhost_svq_driver_area_size(svq),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+    device_area = mmap(NULL, vhost_svq_device_area_size(svq),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+    if (svq->is_packed) {
+        VhostShadowVringPacked *packed = &svq->vring_packed;
+
+        desc_size = sizeof(struct vring_packed_desc) * svq->vring.num;
+        packed->desc = driver_area;
+        packed->driver = (void *)((char *)driver_area + desc_size);
+        packed->device = device_area;
+        packed->next_avail_idx = 0;
+        packed->avail_wrap_counter = true;
+        packed->last_used_idx = 0;
+        packed->used_wrap_counter = true;
+        svq->vring.desc = NULL;
+        svq->vring.avail = NULL;
+        svq->vring.used = NULL;
+    } else {
+        desc_size = sizeof(vring_desc_t) * svq->vring.num;
+        svq->vring.desc = driver_area;
+        svq->vring.avail = (void *)((char *)driver_area + desc_size);
+        svq->vring.used = device_area;
+    }
     svq->desc_state = g_new0(SVQDescState, svq->vring.num);
     svq->desc_next = g_new0(uint16_t, svq->vring.num);
     for (unsigned i = 0; i < svq->vring.num - 1; i++) {
@@ -720,8 +958,13 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
     svq->vq = NULL;
     g_free(svq->desc_next);
     g_free(svq->desc_state);
-    munmap(svq->vring.desc, vhost_svq_driver_area_size(svq));
-    munmap(svq->vring.used, vhost_svq_device_area_size(svq));
+    if (svq->is_packed) {
+        munmap(svq->vring_packed.desc, vhost_svq_driver_area_size(svq));
+        munmap(svq->vring_packed.device, vhost_svq_device_area_size(svq));
+    } else {
+        munmap(svq->vring.desc, vhost_svq_driver_area_size(svq));
+        munmap(svq->vring.used, vhost_svq_device_area_size(svq));
+    }
     event_notifier_set_handler(&svq->hdev_call, NULL);
 }
 
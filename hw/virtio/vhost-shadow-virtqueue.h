@@ -46,11 +46,40 @@ typedef struct VhostShadowVirtqueueOps {
     VirtQueueAvailCallback avail_handler;
 } VhostShadowVirtqueueOps;
 
+/* Packed layout of the shadow vring, driver side state included */
+typedef struct VhostShadowVringPacked {
+    /* Descriptor ring, written by both SVQ and the device */
+    struct vring_packed_desc *desc;
+
+    /* Driver event suppression area, where SVQ asks for calls */
+    struct vring_packed_desc_event *driver;
+
+    /* Device event suppression area, where the device asks for kicks */
+    struct vring_packed_desc_event *device;
+
+    /* Next descriptor to expose to the device and its wrap counter */
+    uint16_t next_avail_idx;
+    bool avail_wrap_counter;
+
+    /* Next descriptor to consume from the device and its wrap counter */
+    uint16_t last_used_idx;
+    bool used_wrap_counter;
+} VhostShadowVringPacked;
+
 /* Shadow virtqueue to relay notifications */
 typedef struct VhostShadowVirtqueue {
-    /* Shadow vring */
+    /*
+     * Shadow vring.  Only vring.num is valid when the packed layout is in
+     * use, the rings are in vring_packed then.
+     */
     struct vring vring;
 
+    /* Shadow vring with VIRTIO_F_RING_PACKED */
+    VhostShadowVringPacked vring_packed;
+
+    /* True if the device uses the packed layout */
+    bool is_packed;
+
     /* Shadow kick notifier, sent to vhost */
     EventNotifier hdev_kick;
     /* Shadow call notifier, sent to vhost */
@@ -86,7 +115,8 @@ typedef struct VhostShadowVirtqueue {
 
     /*
      * Backup next field for each descriptor so we can recover securely, not
-     * needing to trust the device access.
+     * needing to trust the device access.  With the packed layout, this is
+     * the free list of buffer ids instead.
      */
     uint16_t *desc_next;
 
@@ -99,7 +129,7 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
-    /* Next free descriptor */
+    /* Next free descriptor, or buffer id with the packed layout */
     uint16_t free_head;
 
     /* Last seen used idx */
@@ -1189,7 +1189,8 @@ static bool vhost_vdpa_svq_map_rings(struct vhost_dev *dev,
     driver_region = (DMAMap) {
         .translated_addr = svq_addr.desc_user_addr,
         .size = driver_size - 1,
-        .perm = IOMMU_RO,
+        /* The device writes used descriptors back to a packed ring */
+        .perm = svq->is_packed ? IOMMU_RW : IOMMU_RO,
     };
     ok = vhost_vdpa_svq_map_ring(v, &driver_region, errp);
     if (unlikely(!ok)) {
@@ -1225,6 +1226,11 @@ static bool vhost_vdpa_svq_setup(struct vhost_dev *dev,
     };
     int r;
 
+    if (virtio_vdev_has_feature(dev->vdev, VIRTIO_F_RING_PACKED)) {
+        /* Both avail and used wrap counters start at 1 in a packed ring */
+        s.num = 1U << 15 | 1U << 31;
+    }
+
     r = vhost_vdpa_set_dev_vring_base(dev, &s);
     if (unlikely(r)) {
         error_setg_errno(errp, -r, "Cannot set vring base");
@@ -17,9 +17,11 @@
 #include "trace.h"
 #include "qemu/defer-call.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/thread.h"
 #include "qom/object_interfaces.h"
 #include "hw/core/cpu.h"
 #include "hw/virtio/virtio.h"
@@ -1003,6 +1005,22 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1481,6 +1499,107 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
+/*
+ * An element is allocated in one block together with its address and iovec
+ * arrays, so its size depends on the descriptor chain.  Blocks released with
+ * virtqueue_element_free() are kept in a small per-thread cache, one free
+ * list per power-of-two size class, and recycled by the next pop instead of
+ * going back to malloc.  A virtqueue is processed by a single thread, so the
+ * cache behaves like a per-virtqueue slab without any locking.  Chains that
+ * do not fit the largest class are allocated and freed with plain malloc.
+ *
+ * Cached blocks are ordinary g_malloc() allocations, so elements can still be
+ * released with g_free() by devices that do not use virtqueue_element_free().
+ */
+enum {
+    VIRTQUEUE_ELEM_CACHE_MIN_SHIFT = 9,     /* 512 bytes */
+    VIRTQUEUE_ELEM_CACHE_MAX_SHIFT = 14,    /* 16 KiB */
+    VIRTQUEUE_ELEM_CACHE_CLASSES =
+        VIRTQUEUE_ELEM_CACHE_MAX_SHIFT - VIRTQUEUE_ELEM_CACHE_MIN_SHIFT + 1,
+
+    /* Maximum number of free blocks kept per class and thread */
+    VIRTQUEUE_ELEM_CACHE_DEPTH = 256,
+};
+
+typedef struct VirtQueueElementCache {
+    /* Free blocks are linked through their first word */
+    void *head[VIRTQUEUE_ELEM_CACHE_CLASSES];
+    unsigned int size[VIRTQUEUE_ELEM_CACHE_CLASSES];
+} VirtQueueElementCache;
+
+static __thread VirtQueueElementCache elem_cache;
+static __thread Notifier elem_cache_cleanup_notifier;
+
+/* Called at thread cleanup time */
+static void virtqueue_element_cache_cleanup(Notifier *n, void *value)
+{
+    unsigned int i;
+
+    for (i = 0; i < VIRTQUEUE_ELEM_CACHE_CLASSES; i++) {
+        while (elem_cache.head[i]) {
+            void *block = elem_cache.head[i];
+
+            elem_cache.head[i] = *(void **)block;
+            g_free(block);
+        }
+        elem_cache.size[i] = 0;
+    }
+}
+
+/* Returns the cache class + 1 for a block of @size bytes, or 0 if too big */
+static unsigned int virtqueue_element_cache_class(size_t size)
+{
+    unsigned int shift;
+
+    if (size > (1 << VIRTQUEUE_ELEM_CACHE_MAX_SHIFT)) {
+        return 0;
+    }
+    shift = MAX(VIRTQUEUE_ELEM_CACHE_MIN_SHIFT, 64 - clz64(size - 1));
+    return shift - VIRTQUEUE_ELEM_CACHE_MIN_SHIFT + 1;
+}
+
+static void *virtqueue_element_cache_get(unsigned int cache_class)
+{
+    unsigned int i = cache_class - 1;
+    void *block = elem_cache.head[i];
+
+    if (!block) {
+        return g_malloc(1 << (i + VIRTQUEUE_ELEM_CACHE_MIN_SHIFT));
+    }
+    elem_cache.head[i] = *(void **)block;
+    elem_cache.size[i]--;
+    return block;
+}
+
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    unsigned int i;
+
+    if (!elem) {
+        return;
+    }
+    if (!elem->cache_class) {
+        g_free(elem);
+        return;
+    }
+
+    i = elem->cache_class - 1;
+    if (elem_cache.size[i] >= VIRTQUEUE_ELEM_CACHE_DEPTH) {
+        g_free(elem);
+        return;
+    }
+
+    /* Ensure the atexit notifier is registered */
+    if (!elem_cache_cleanup_notifier.notify) {
+        elem_cache_cleanup_notifier.notify = virtqueue_element_cache_cleanup;
+        qemu_thread_atexit_add(&elem_cache_cleanup_notifier);
+    }
+
+    *(void **)elem = elem_cache.head[i];
+    elem_cache.head[i] = elem;
+    elem_cache.size[i]++;
+}
+
 static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
@@ -1490,10 +1609,16 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+    unsigned int cache_class = virtqueue_element_cache_class(out_sg_end);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (cache_class) {
+        elem = virtqueue_element_cache_get(cache_class);
+    } else {
+        elem = g_malloc(out_sg_end);
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->cache_class = cache_class;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
@@ -1503,7 +1628,12 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock().  The avail event is left to the caller when
+ * @set_avail_event is false, so that a batch of pops only writes it once.
+ */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 bool set_avail_event)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1520,7 +1650,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_empty_rcu(vq)) {
         goto done;
     }
@@ -1542,7 +1671,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (set_avail_event &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1642,6 +1772,7 @@ err_undo_map:
     goto done;
 }
 
+/* Called within rcu_read_lock().  */
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -1660,7 +1791,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_packed_empty_rcu(vq)) {
         goto done;
     }
@@ -1785,11 +1915,48 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
         return NULL;
     }
 
+    RCU_READ_LOCK_GUARD();
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         return virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, true);
+    }
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    uint16_t old_avail_idx = vq->last_avail_idx;
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    /*
+     * One RCU critical section for the whole batch.  The avail index that
+     * the first pop reads is kept in shadow_avail_idx, so guest memory is
+     * only read again once all the entries it announced have been taken.
+     */
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz) :
+                              virtqueue_split_pop(vq, sz, false);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
     }
+
+    if (!packed && vq->last_avail_idx != old_avail_idx &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
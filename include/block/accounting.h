@@ -27,10 +27,13 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-types-common.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
 typedef struct BlockAcctStats BlockAcctStats;
+typedef struct BlockAcctShard BlockAcctShard;
 
 enum BlockAcctType {
     BLOCK_ACCT_NONE = 0,
@@ -50,6 +53,8 @@ struct BlockAcctTimedStats {
 };
 
 typedef struct BlockLatencyHistogram {
+    struct rcu_head rcu;
+
     /* The following histogram is represented like this:
      *
      * 5|           *
@@ -72,15 +77,39 @@ typedef struct BlockLatencyHistogram {
      *
      * So, for example above, histogram intervals are:
      * [0, 10), [10, 50), [50, 100), [100, +inf)
+     *
+     * The bins are kept once per shard (see BlockAcctShard) and summed up
+     * by block_latency_histogram_bin().  Changing the boundaries replaces
+     * the whole histogram, which is freed after an RCU grace period.
      */
     int nbins;
     uint64_t *boundaries; /* @nbins-1 numbers here
                              (all boundaries, except 0 and +inf) */
-    uint64_t *bins;
+    int stride;           /* distance between the bins of two shards */
+    Stat64 *bins;         /* BLOCK_ACCT_SHARDS * @stride counters */
 } BlockLatencyHistogram;
 
-struct BlockAcctStats {
-    QemuMutex lock;
+/*
+ * Each thread that completes requests updates one of BLOCK_ACCT_SHARDS
+ * copies of the counters, so that iothreads serving the same BlockBackend
+ * do not bounce a lock or a cache line between them.  The copies are only
+ * added up when the statistics are queried.
+ */
+#define BLOCK_ACCT_SHARDS 8
+#define BLOCK_ACCT_SHARD_ALIGN 64
+
+struct BlockAcctShard {
+    Stat64 nr_bytes[BLOCK_MAX_IOTYPE];
+    Stat64 nr_ops[BLOCK_MAX_IOTYPE];
+    Stat64 invalid_ops[BLOCK_MAX_IOTYPE];
+    Stat64 failed_ops[BLOCK_MAX_IOTYPE];
+    Stat64 total_time_ns[BLOCK_MAX_IOTYPE];
+    Stat64 merged[BLOCK_MAX_IOTYPE];
+    Stat64 last_access_time_ns;
+} QEMU_ALIGNED(BLOCK_ACCT_SHARD_ALIGN);
+
+/* Sum of all shards, as returned by block_acct_get_counters() */
+typedef struct BlockAcctCounters {
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
     uint64_t nr_ops[BLOCK_MAX_IOTYPE];
     uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
@@ -88,10 +117,16 @@ struct BlockAcctStats {
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t merged[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
+} BlockAcctCounters;
+
+struct BlockAcctStats {
+    QemuMutex lock; /* protects the TimedAverages in @intervals */
+    BlockAcctShard *shards;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
-    BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    /* NULL if disabled, protected by RCU */
+    BlockLatencyHistogram *latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
 typedef struct BlockAcctCookie {
@@ -114,11 +149,14 @@ void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
+void block_acct_get_counters(BlockAcctStats *stats,
+                             BlockAcctCounters *counters);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+uint64_t block_latency_histogram_bin(BlockLatencyHistogram *hist, int bin);
 
 #endif
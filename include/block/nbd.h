@@ -403,6 +403,8 @@ AioContext *nbd_export_aio_context(NBDExport *exp);
 NBDExport *nbd_export_find(const char *name);
 
 void nbd_client_new(QIOChannelSocket *sioc,
+                    AioContext *ctx,
+                    bool zero_copy,
                     QCryptoTLSCreds *tlscreds,
                     const char *tlsauthz,
                     void (*close_fn)(NBDClient *, bool));
@@ -414,6 +416,7 @@ bool nbd_server_is_running(void);
 int nbd_server_max_connections(void);
 void nbd_server_start(SocketAddress *addr, const char *tls_creds,
                       const char *tls_authz, uint32_t max_connections,
+                      strList *iothreads, bool zero_copy_send,
                       Error **errp);
 void nbd_server_start_options(NbdServerOptions *arg, Error **errp);
 
@@ -913,6 +913,25 @@ struct MemoryListener {
      */
     void (*region_nop)(MemoryListener *listener, MemoryRegionSection *section);
 
+    /**
+     * @region_update:
+     *
+     * Called during an address space update transaction, with all the
+     * sections that disappeared from the address space and all those that
+     * are new in it.  Both arrays are sorted by address.  A listener that
+     * implements it must not implement #MemoryListener.region_add() or
+     * #MemoryListener.region_del().
+     *
+     * @listener: The #MemoryListener.
+     * @del: The old #MemoryRegionSection array.
+     * @nr_del: Number of elements in @del.
+     * @add: The new #MemoryRegionSection array.
+     * @nr_add: Number of elements in @add.
+     */
+    void (*region_update)(MemoryListener *listener,
+                          MemoryRegionSection *del, unsigned nr_del,
+                          MemoryRegionSection *add, unsigned nr_add);
+
     /**
      * @log_start:
      *
@@ -195,8 +195,25 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb is set associative: CPU_VTLB_SETS sets, selected by the
+ * low bits of the virtual page number, of CPU_VTLB_WAYS entries each.
+ * Both may be overridden at build time, but must be powers of 2.
+ */
+#ifndef CPU_VTLB_SETS_BITS
+#define CPU_VTLB_SETS_BITS 4
+#endif
+#ifndef CPU_VTLB_WAYS
+#define CPU_VTLB_WAYS 4
+#endif
+#define CPU_VTLB_SETS (1 << CPU_VTLB_SETS_BITS)
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
+
+/*
+ * Number of distinct page ranges that may be queued for flushing on a
+ * vCPU by other vCPUs before the batch is turned into a full flush.
+ */
+#define CPU_TLB_FLUSH_BATCH_SIZE 16
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -279,14 +296,32 @@ typedef struct CPUTLBDesc {
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
-    /* The tlb victim table, in two parts.  */
+    /*
+     * The last page that missed in the fast tlb, whether or not the
+     * victim tlb then hit.  A miss on exactly the following page counts
+     * as a sequential miss stream; -1 after a flush.
+     */
+    vaddr last_miss_page;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
+    /*
+     * The tlb victim table, in two parts.  Set N occupies the
+     * CPU_VTLB_WAYS entries beginning at N * CPU_VTLB_WAYS.
+     */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/*
+ * A range of pages queued for flushing, see CPUTLBCommon.pending.
+ */
+typedef struct CPUTLBFlushRange {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+} CPUTLBFlushRange;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -307,6 +342,23 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t vtlb_hit_count;
+    size_t vtlb_prefetch_count;
+    size_t batch_flush_count;
+    size_t batch_page_count;
+    size_t batch_merge_count;
+    size_t batch_overflow_count;
+    /*
+     * Page flushes requested by other vCPUs, coalesced into ranges and
+     * performed at once by the next queued tlb_flush_batch_async_work.
+     * @pending_full is the set of mmu_idx for which the batch overflowed
+     * and the whole tlb is to be flushed instead.
+     * Protected by tlb_c.lock.
+     */
+    bool pending_scheduled;
+    uint16_t pending_full;
+    unsigned pending_count;
+    CPUTLBFlushRange pending[CPU_TLB_FLUSH_BATCH_SIZE];
 } CPUTLBCommon;
 
 /*
@@ -479,6 +531,8 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    /* Set by the TB profiler, cleared when this cpu has taken a sample. */
+    bool tb_profile_pending;
     int exclusive_context_count;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
@@ -30,6 +30,7 @@ struct SCSIRequest {
     int16_t           status;
     int16_t           host_status;
     void              *hba_private;
+    AioContext        *ctx; /* where the request is processed */
     uint64_t          residual;
     SCSICommand       cmd;
     NotifierList      cancel_notifiers;
@@ -77,9 +78,10 @@ struct SCSIDevice
     uint32_t sense_len;
 
     /*
-     * The requests list is only accessed from the AioContext that executes
-     * requests or from the main loop when IOThread processing is stopped.
+     * Requests may run in different AioContexts when the HBA processes its
+     * queues in several IOThreads, so the list is protected by requests_lock.
      */
+    QemuMutex requests_lock;
     QTAILQ_HEAD(, SCSIRequest) requests;
 
     uint32_t channel;
@@ -18,6 +18,7 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/gro.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
 
@@ -56,6 +57,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    bool gro;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -151,6 +153,40 @@ typedef struct VirtioNetRssData {
     uint16_t default_queue;
 } VirtioNetRssData;
 
+/* Number of flows tracked by automatic flow steering, a power of 2 */
+#define VIRTIO_NET_FLOW_TABLE_SIZE      4096
+
+/* Ports are in network byte order; IPv4 addresses fill the first 4 bytes */
+typedef struct VirtioNetFlowKey {
+    uint8_t proto;
+    bool ipv6;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t src_ip[16];
+    uint8_t dst_ip[16];
+} VirtioNetFlowKey;
+
+typedef struct VirtioNetFlowRule {
+    NetFlowRule *conf;
+    int family;             /* of the addresses; AF_UNSPEC if there are none */
+    uint8_t proto;          /* 0 to match any protocol */
+    uint8_t src_ip[16];
+    uint8_t dst_ip[16];
+    QTAILQ_ENTRY(VirtioNetFlowRule) next;
+} VirtioNetFlowRule;
+
+typedef struct VirtioNetFlowEntry {
+    uint32_t hash;
+    uint16_t queue;         /* queue pair + 1, 0 if the entry is free */
+} VirtioNetFlowEntry;
+
+typedef struct VirtioNetFlowSteering {
+    QTAILQ_HEAD(, VirtioNetFlowRule) rules;
+    /* Direct-mapped table of flows learnt from transmitted packets */
+    VirtioNetFlowEntry *table;
+    uint32_t nr_flows;
+} VirtioNetFlowSteering;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -160,6 +196,9 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Receive-side TCP coalescing, flushed by gro_bh at the end of a burst */
+    NetGRO *gro;
+    QEMUBH *gro_bh;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -223,6 +262,9 @@ struct VirtIONet {
     bool primary_opts_from_json;
     NotifierWithReturn migration_state;
     VirtioNetRssData rss_data;
+    VirtioNetFlowSteering flow_steering;
+    /* Flushes GRO when the VM stops, only with the gro property */
+    VMChangeStateEntry *gro_vmstate;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
@@ -69,6 +69,7 @@ typedef struct VirtQueueElement
     unsigned int ndescs;
     unsigned int out_num;
     unsigned int in_num;
+    unsigned int cache_class;   /* see virtqueue_element_free() */
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -254,6 +255,12 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+/*
+ * Fill @count used elements with lengths @lens and make them visible to the
+ * guest with a single used index update.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -265,6 +272,18 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Release an element returned by virtqueue_pop().  Its memory is recycled
+ * by later pops in the calling thread; g_free() also works but bypasses the
+ * cache.
+ */
+void virtqueue_element_free(VirtQueueElement *elem);
+/*
+ * Pop up to @max elements of size @sz into @elems.  Returns the number of
+ * elements popped, which are released like virtqueue_pop()'s.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -49,6 +49,10 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    /* Value of zero_copy_sent at the last qio_channel_flush() */
+    ssize_t zero_copy_flushed;
+    /* True if the kernel copied the data of all sends completed since then */
+    bool zero_copy_all_copied;
 };
 
 
@@ -262,4 +266,38 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to enable QIO_CHANNEL_WRITE_FLAG_ZERO_COPY for a connected
+ * socket.  This is done automatically for sockets connected with
+ * qio_channel_socket_connect_sync(), but not for accepted sockets.
+ *
+ * Returns: true if zero copy writes are now supported, false otherwise
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+
+/**
+ * qio_channel_socket_zero_copy_completed:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the completion notifications that the kernel has already
+ * queued for writes done with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY.
+ * Unlike qio_channel_flush(), this does not block waiting for the
+ * writes that are still in flight.
+ *
+ * The buffer of a zero copy write may be reused once the count
+ * returned here reaches the value that zero_copy_queued had right
+ * after that write.
+ *
+ * Returns: the number of zero copy writes that have completed since
+ * the channel was created, or -1 on error
+ */
+ssize_t qio_channel_socket_zero_copy_completed(QIOChannelSocket *ioc,
+                                               Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Generic receive offload: coalescing of TCP segments into GSO frames.
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+#include "standard-headers/linux/virtio_net.h"
+
+typedef struct NetGRO NetGRO;
+
+/*
+ * Deliver an Ethernet frame.  @hdr describes a coalesced GSO frame, or is
+ * NULL for a frame that is passed through unchanged.  Returns the same
+ * values as NetReceive; 0 means that the frame must be retried later.
+ */
+typedef ssize_t (NetGRODeliverFunc)(void *opaque,
+                                    const struct virtio_net_hdr *hdr,
+                                    const uint8_t *buf, size_t size);
+
+NetGRO *net_gro_new(NetGRODeliverFunc *deliver, void *opaque);
+void net_gro_free(NetGRO *gro);
+
+/* Select which of TCP over IPv4 and IPv6 is coalesced. */
+void net_gro_set_offloads(NetGRO *gro, bool tso4, bool tso6);
+
+/*
+ * Feed a received frame.  TCP segments that continue a flow are held and
+ * merged with their successors; anything else is delivered right away,
+ * after the data held for the same flow.  Returns like NetReceive.
+ */
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size);
+
+/*
+ * Deliver all held frames, normally at the end of a burst.  Returns false
+ * if some could not be delivered and are still held.
+ */
+bool net_gro_flush(NetGRO *gro);
+
+/* Returns true if frames are held. */
+bool net_gro_has_pending(NetGRO *gro);
+
+/* Drop all held frames. */
+void net_gro_purge(NetGRO *gro);
+
+#endif /* QEMU_NET_GRO_H */
@@ -49,6 +49,18 @@ typedef int (NetLoad)(NetClientState *);
 typedef void (NetStop)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
+
+typedef struct NetPacketIOV {
+    const struct iovec *iov;
+    int iovcnt;
+} NetPacketIOV;
+
+/*
+ * Receive a burst of packets at once.  Returns the number of packets that
+ * were consumed, i.e. sent or dropped; the first packet that is not consumed
+ * is retried through the regular per-packet path.
+ */
+typedef int (NetReceiveIOVBatch)(NetClientState *, const NetPacketIOV *, int);
 typedef void (NetCleanup) (NetClientState *);
 typedef void (LinkStatusChanged)(NetClientState *);
 typedef void (NetClientDestructor)(NetClientState *);
@@ -69,6 +81,10 @@ typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
+typedef bool (NetFlowRuleAdd)(NetClientState *, const NetFlowRule *, Error **);
+typedef bool (NetFlowRuleDel)(NetClientState *, uint32_t, Error **);
+typedef bool (NetFlowSteeringSet)(NetClientState *, bool, Error **);
+typedef NetFlowSteeringInfo *(QueryFlowSteering)(NetClientState *);
 
 typedef struct NetClientInfo {
     NetClientDriver type;
@@ -76,6 +92,7 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceive *receive_raw;
     NetReceiveIOV *receive_iov;
+    NetReceiveIOVBatch *receive_iov_batch;
     NetCanReceive *can_receive;
     NetStart *start;
     NetLoad *load;
@@ -98,6 +115,10 @@ typedef struct NetClientInfo {
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
     NetCheckPeerType *check_peer_type;
+    NetFlowRuleAdd *flow_rule_add;
+    NetFlowRuleDel *flow_rule_del;
+    NetFlowSteeringSet *flow_steering_set;
+    QueryFlowSteering *query_flow_steering;
 } NetClientInfo;
 
 struct NetClientState {
@@ -176,6 +197,8 @@ ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
                           int iovcnt);
 ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
                                 int iovcnt, NetPacketSent *sent_cb);
+int qemu_sendv_packet_batch_async(NetClientState *nc, const NetPacketIOV *pkts,
+                                  int count, NetPacketSent *sent_cb);
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_receive_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_receive_packet_iov(NetClientState *nc,
@@ -61,6 +61,35 @@ struct HBitmapIter {
  */
 HBitmap *hbitmap_alloc(uint64_t size, int granularity);
 
+/**
+ * hbitmap_copy:
+ * @hb: The bitmap to copy.
+ *
+ * Return a new HBitmap with the same size, granularity and contents as @hb.
+ * The copy is not affected by later changes to @hb, so it can be iterated
+ * without holding the lock that protects @hb.
+ */
+HBitmap *hbitmap_copy(const HBitmap *hb);
+
+/**
+ * hbitmap_set_sparse:
+ * @hb: The bitmap to change.
+ * @sparse: Whether the bitmap should be sparse.
+ *
+ * A sparse bitmap only allocates memory for the areas that are neither
+ * entirely clear nor entirely set, at the cost of allocating and freeing
+ * memory as bits are set and reset.  Bitmaps are not sparse by default.
+ */
+void hbitmap_set_sparse(HBitmap *hb, bool sparse);
+
+/**
+ * hbitmap_is_sparse:
+ * @hb: HBitmap to operate on.
+ *
+ * Return whether the bitmap is sparse.
+ */
+bool hbitmap_is_sparse(const HBitmap *hb);
+
 /**
  * hbitmap_truncate:
  * @hb: The bitmap to change the size of.
@@ -42,6 +42,13 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * NBD_ZERO_COPY_MIN: smallest read payload that is sent with MSG_ZEROCOPY.
+ * Below this, pinning the pages and handling the completion notification
+ * costs more than copying the data into the socket buffer.
+ */
+#define NBD_ZERO_COPY_MIN (32 * KiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -83,8 +90,16 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    bool zero_copy; /* data may be referenced by a zero copy send */
 };
 
+/* A read buffer that the kernel may still be transmitting from */
+typedef struct NBDZeroCopyBuf {
+    void *data;
+    ssize_t seq; /* freed when this many zero copy sends have completed */
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) next;
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -128,6 +143,7 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    AioContext *ctx; /* IOThread serving this connection, or NULL */
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
@@ -147,6 +163,9 @@ struct NBDClient {
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
+    bool zero_copy; /* Send read payloads with MSG_ZEROCOPY */
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuf) zero_copy_bufs; /* protected by lock */
+
     NBDMode mode;
     NBDMetaContexts contexts; /* Negotiated meta contexts */
 
@@ -157,6 +176,15 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/*
+ * Returns the AioContext in which requests of @client are processed: the
+ * IOThread that the connection was assigned to, if any, else the export's.
+ */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: nbd_export_aio_context(client->exp);
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -1510,7 +1538,7 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
-/* Runs in export AioContext and main loop thread */
+/* Runs in client AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
     qatomic_inc(&client->refcount);
@@ -1518,6 +1546,8 @@ void nbd_client_get(NBDClient *client)
 
 void nbd_client_put(NBDClient *client)
 {
+    NBDZeroCopyBuf *buf;
+
     assert(qemu_in_main_thread());
 
     if (qatomic_fetch_dec(&client->refcount) == 1) {
@@ -1532,11 +1562,20 @@ void nbd_client_put(NBDClient *client)
             object_unref(OBJECT(client->tlscreds));
         }
         g_free(client->tlsauthz);
+        if (client->ctx) {
+            aio_context_unref(client->ctx);
+        }
         if (client->exp) {
             QTAILQ_REMOVE(&client->exp->clients, client, next);
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        /* The socket is closed, so the kernel is done with these */
+        while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+            QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+            qemu_vfree(buf->data);
+            g_free(buf);
+        }
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1591,7 +1630,7 @@ static void client_close(NBDClient *client, bool negotiated)
     }
 }
 
-/* Runs in export AioContext with client->lock held */
+/* Runs in client AioContext with client->lock held */
 static NBDRequestData *nbd_request_get(NBDClient *client)
 {
     NBDRequestData *req;
@@ -1604,12 +1643,47 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     return req;
 }
 
-/* Runs in export AioContext with client->lock held */
+/*
+ * Free read buffers whose zero copy sends have completed.  Runs in client
+ * AioContext with client->lock held.
+ */
+static void nbd_zero_copy_reap(NBDClient *client)
+{
+    NBDZeroCopyBuf *buf;
+    ssize_t done;
+
+    done = qio_channel_socket_zero_copy_completed(client->sioc, NULL);
+    if (done < 0) {
+        /* Keep the buffers until the client goes away */
+        return;
+    }
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_bufs)) &&
+           buf->seq <= done) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, next);
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
+/* Runs in client AioContext with client->lock held */
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data && req->zero_copy) {
+        /*
+         * Any zero copy send of this buffer has been queued already, so
+         * it is safe to free once the current count of queued sends has
+         * completed.
+         */
+        NBDZeroCopyBuf *buf = g_new(NBDZeroCopyBuf, 1);
+
+        buf->data = req->data;
+        buf->seq = client->sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+        nbd_zero_copy_reap(client);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1683,7 +1757,7 @@ static void nbd_drained_end(void *opaque)
     }
 }
 
-/* Runs in export AioContext */
+/* Runs in the client's AioContext */
 static void nbd_wake_read_bh(void *opaque)
 {
     NBDClient *client = opaque;
@@ -1704,12 +1778,12 @@ static bool nbd_drained_poll(void *opaque)
                  * If there's a coroutine waiting for a request on nbd_read_eof()
                  * enter it here so we don't depend on the client to wake it up.
                  *
-                 * Schedule a BH in the export AioContext to avoid missing the
+                 * Schedule a BH in the client's AioContext to avoid missing the
                  * wake up due to the race between qio_channel_wake_read() and
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -2004,6 +2078,47 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is the payload of a
+ * read reply.  If the client uses zero copy, the payload is handed to the
+ * network stack without copying it, and the buffer must stay unchanged
+ * until the kernel is done with it; nbd_request_put() takes care of that.
+ * The headers are copied as usual, because they live on the stack.
+ */
+static int coroutine_fn nbd_co_send_read_iov(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             Error **errp)
+{
+    int ret;
+
+    if (!client->zero_copy || iov[niov - 1].iov_len < NBD_ZERO_COPY_MIN) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /*
+     * The headers and the payload are separate sendmsg() calls, so make
+     * sure the headers do not go out as a segment of their own.  nbd_trip()
+     * corks the socket for the whole request, but another request may have
+     * uncorked it in the meantime; nbd_trip() uncorks it again at the end.
+     */
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, &iov[niov - 1], 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2035,7 +2150,10 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    if (len) {
+        return nbd_co_send_read_iov(client, iov, 2, errp);
+    }
+    return nbd_co_send_iov(client, iov, 1, errp);
 }
 
 /*
@@ -2116,7 +2234,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_read_iov(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2722,6 +2840,9 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
             error_setg(errp, "No memory");
             return -ENOMEM;
         }
+        req->zero_copy = client->zero_copy &&
+                         request->type == NBD_CMD_READ &&
+                         request->len >= NBD_ZERO_COPY_MIN;
     }
     if (payload_len) {
         if (payload_okay) {
@@ -3134,7 +3255,7 @@ disconnect:
 }
 
 /*
- * Runs in export AioContext and main loop thread. Caller must hold
+ * Runs in client AioContext and main loop thread. Caller must hold
  * client->lock.
  */
 static void nbd_client_receive_next_request(NBDClient *client)
@@ -3146,7 +3267,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         nbd_client_get(client);
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client), client->recv_coroutine);
     }
 }
 
@@ -3165,6 +3286,16 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /*
+     * Read payloads can only be sent straight from the request buffer if
+     * they are not encrypted, i.e. the client did not switch to TLS.
+     */
+    if (client->zero_copy) {
+        client->zero_copy = client->ioc == QIO_CHANNEL(client->sioc) &&
+            qio_channel_socket_enable_zero_copy(client->sioc);
+        trace_nbd_co_client_start_zero_copy(client->zero_copy);
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -3174,8 +3305,18 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
  * Create a new client listener using the given channel @sioc.
  * Begin servicing it in a coroutine.  When the connection closes, call
  * @close_fn with an indication of whether the client completed negotiation.
+ *
+ * Negotiation always happens in the main loop.  If @ctx is not NULL,
+ * requests are then received, processed and replied to in @ctx instead
+ * of the export's AioContext, so that several connections to the same
+ * export can be served by different IOThreads.
+ *
+ * If @zero_copy is true and the connection does not use TLS, read payloads
+ * are sent with MSG_ZEROCOPY when the host supports it.
  */
 void nbd_client_new(QIOChannelSocket *sioc,
+                    AioContext *ctx,
+                    bool zero_copy,
                     QCryptoTLSCreds *tlscreds,
                     const char *tlsauthz,
                     void (*close_fn)(NBDClient *, bool))
@@ -3186,6 +3327,12 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
     client->refcount = 1;
+    client->ctx = ctx;
+    client->zero_copy = zero_copy;
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
+    if (ctx) {
+        aio_context_ref(ctx);
+    }
     client->tlscreds = tlscreds;
     if (tlscreds) {
         object_ref(OBJECT(client->tlscreds));
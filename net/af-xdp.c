@@ -116,6 +116,12 @@ static void af_xdp_complete_tx(AFXDPState *s)
     }
 }
 
+/* Reserve a tx descriptor if there is also a free buffer to put in it */
+static bool af_xdp_tx_reserve(AFXDPState *s, uint32_t *idx)
+{
+    return s->n_pool && xsk_ring_prod__reserve(&s->tx, 1, idx);
+}
+
 /*
  * The fd_write() callback, invoked if the fd is marked as writable
  * after a poll.
@@ -139,37 +145,54 @@ static void af_xdp_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
-static ssize_t af_xdp_receive(NetClientState *nc,
-                              const uint8_t *buf, size_t size)
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
 {
     AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
     struct xdp_desc *desc;
     uint32_t idx;
     void *data;
 
-    /* Try to recover buffers that are already sent. */
-    af_xdp_complete_tx(s);
+    /*
+     * Recover buffers that are already sent only when running low, so that
+     * the completion queue is drained in batches rather than per packet.
+     * The completion queue is smaller than the pool, so also drain it before
+     * it fills up: the kernel stops processing the tx ring while it is full,
+     * and POLLOUT would then never be reported to do it in af_xdp_writable().
+     */
+    if (s->n_pool < AF_XDP_BATCH_SIZE ||
+        s->outstanding_tx >= XSK_RING_CONS__DEFAULT_NUM_DESCS
+                             - AF_XDP_BATCH_SIZE) {
+        af_xdp_complete_tx(s);
+    }
 
     if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
         /* We can't transmit packet this size... */
         return size;
     }
 
-    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
-        /*
-         * Out of buffers or space in tx ring.  Poll until we can write.
-         * This will also kick the Tx, if it was waiting on CQ.
-         */
-        af_xdp_write_poll(s, true);
-        return 0;
+    if (!af_xdp_tx_reserve(s, &idx)) {
+        /* The ring may be stuck behind unreaped completions, retry once. */
+        af_xdp_complete_tx(s);
+
+        if (!af_xdp_tx_reserve(s, &idx)) {
+            /*
+             * Out of buffers or space in tx ring.  Poll until we can write.
+             * This will also kick the Tx, if it was waiting on CQ.
+             */
+            af_xdp_write_poll(s, true);
+            return 0;
+        }
     }
 
     desc = xsk_ring_prod__tx_desc(&s->tx, idx);
     desc->addr = s->pool[--s->n_pool];
     desc->len = size;
 
+    /* Gather the packet straight into the umem frame. */
     data = xsk_umem__get_data(s->buffer, desc->addr);
-    memcpy(data, buf, size);
+    iov_to_buf(iov, iovcnt, 0, data, size);
 
     xsk_ring_prod__submit(&s->tx, 1);
     s->outstanding_tx++;
@@ -181,6 +204,17 @@ static ssize_t af_xdp_receive(NetClientState *nc,
     return size;
 }
 
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
 /*
  * Complete a previous send (backend --> guest) and enable the
  * fd_read callback.
@@ -196,6 +230,11 @@ static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
 {
     uint32_t i, idx = 0;
 
+    /* Tx completions are reclaimed lazily, pick them up before giving up. */
+    if (s->n_pool < n + 1) {
+        af_xdp_complete_tx(s);
+    }
+
     /* Leave one packet for Tx, just in case. */
     if (s->n_pool < n + 1) {
         n = s->n_pool;
@@ -401,6 +440,7 @@ static NetClientInfo net_af_xdp_info = {
     .type = NET_CLIENT_DRIVER_AF_XDP,
     .size = sizeof(AFXDPState),
     .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
 };
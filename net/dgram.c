@@ -100,6 +100,49 @@ static ssize_t net_dgram_receive(NetClientState *nc,
     return ret;
 }
 
+#ifdef CONFIG_LINUX
+#define NET_DGRAM_BATCH_SIZE 64
+
+/* Transmit a burst of packets with as few sendmmsg() calls as possible. */
+static int net_dgram_receive_iov_batch(NetClientState *nc,
+                                       const NetPacketIOV *pkts, int count)
+{
+    NetDgramState *s = DO_UPCAST(NetDgramState, nc, nc);
+    struct mmsghdr msgs[NET_DGRAM_BATCH_SIZE];
+    int i, n, done = 0;
+    int ret;
+
+    while (done < count) {
+        n = MIN(count - done, NET_DGRAM_BATCH_SIZE);
+        for (i = 0; i < n; i++) {
+            msgs[i] = (struct mmsghdr) {
+                .msg_hdr = {
+                    .msg_name = s->dest_addr,
+                    .msg_namelen = s->dest_addr ? s->dest_len : 0,
+                    .msg_iov = (struct iovec *)pkts[done + i].iov,
+                    .msg_iovlen = pkts[done + i].iovcnt,
+                },
+            };
+        }
+
+        ret = sendmmsg(s->fd, msgs, n, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                net_dgram_write_poll(s, true);
+                break;
+            }
+            /* Drop the packet that failed, like net_dgram_receive() */
+            ret = 1;
+        }
+        done += ret;
+    }
+    return done;
+}
+#endif
+
 static void net_dgram_send_completed(NetClientState *nc, ssize_t len)
 {
     NetDgramState *s = DO_UPCAST(NetDgramState, nc, nc);
@@ -253,6 +296,9 @@ static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_DGRAM,
     .size = sizeof(NetDgramState),
     .receive = net_dgram_receive,
+#ifdef CONFIG_LINUX
+    .receive_iov_batch = net_dgram_receive_iov_batch,
+#endif
     .cleanup = net_dgram_cleanup,
 };
 
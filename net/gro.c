@@ -0,0 +1,367 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Generic receive offload.
+ *
+ * In-order TCP segments of a flow are appended to a single frame whose
+ * headers are those of the first segment, and handed over as a GSO frame
+ * together with a virtio-net header describing how to resegment it.  The
+ * rules follow those of the Linux GRO engine: only plain ACK segments
+ * without IP options are merged, all headers but the lengths and sequence
+ * number must match, and a segment shorter than the MSS or with PSH set
+ * ends the frame.  Checksums are verified before merging, so the result is
+ * marked as VIRTIO_NET_HDR_F_DATA_VALID.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+
+#define NET_GRO_MAX_FLOWS   8
+#define NET_GRO_MAX_SIZE    (ETH_HLEN + ETH_MAX_IP_DGRAM_LEN)
+
+#define IP4_HLEN            sizeof(struct ip_header)
+#define IP6_HLEN            sizeof(struct ip6_header)
+#define TCP_HLEN            sizeof(struct tcp_header)
+
+#define TCP_FLAGS_OFFSET    13
+#define TCP_FLAG_PSH        0x08
+
+typedef struct NetGROFlow {
+    bool active;
+    bool closed;            /* the frame ended, but could not be delivered */
+    bool ipv6;
+    uint8_t *buf;           /* the coalesced frame, NET_GRO_MAX_SIZE bytes */
+    size_t size;
+    size_t l4_off;          /* offset of the TCP header */
+    size_t hdr_len;         /* offset of the TCP payload */
+    uint32_t next_seq;
+    uint16_t mss;
+    unsigned int segs;
+} NetGROFlow;
+
+struct NetGRO {
+    NetGRODeliverFunc *deliver;
+    void *opaque;
+    bool tso4;
+    bool tso6;
+    unsigned int next_evict;
+    NetGROFlow flows[NET_GRO_MAX_FLOWS];
+};
+
+/* A parsed TCP segment that is a candidate for merging */
+typedef struct NetGROSegment {
+    bool ipv6;
+    size_t size;            /* frame size without Ethernet padding */
+    size_t l4_off;
+    size_t hdr_len;
+    size_t payload;
+    uint32_t seq;
+    uint8_t flags;
+} NetGROSegment;
+
+NetGRO *net_gro_new(NetGRODeliverFunc *deliver, void *opaque)
+{
+    NetGRO *gro = g_new0(NetGRO, 1);
+
+    gro->deliver = deliver;
+    gro->opaque = opaque;
+    return gro;
+}
+
+void net_gro_free(NetGRO *gro)
+{
+    unsigned int i;
+
+    if (!gro) {
+        return;
+    }
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
+
+void net_gro_set_offloads(NetGRO *gro, bool tso4, bool tso6)
+{
+    gro->tso4 = tso4;
+    gro->tso6 = tso6;
+}
+
+static bool net_gro_parse(NetGRO *gro, const uint8_t *buf, size_t size,
+                          NetGROSegment *seg)
+{
+    const uint8_t *ip = buf + ETH_HLEN;
+    const uint8_t *tcp;
+    size_t l4_len, tcp_hlen;
+    uint32_t sum;
+
+    if (size < ETH_HLEN) {
+        return false;
+    }
+
+    switch (lduw_be_p(&PKT_GET_ETH_HDR(buf)->h_proto)) {
+    case ETH_P_IP:
+        if (!gro->tso4 || size < ETH_HLEN + IP4_HLEN + TCP_HLEN ||
+            ip[0] != 0x45 ||
+            ldub_p(ip + offsetof(struct ip_header, ip_p)) != IP_PROTO_TCP ||
+            IP4_IS_FRAGMENT((const struct ip_header *)ip) ||
+            net_raw_checksum((uint8_t *)ip, IP4_HLEN)) {
+            return false;
+        }
+        seg->ipv6 = false;
+        seg->l4_off = ETH_HLEN + IP4_HLEN;
+        seg->size = ETH_HLEN +
+                    lduw_be_p(ip + offsetof(struct ip_header, ip_len));
+        sum = net_checksum_add(8, (uint8_t *)ip +
+                               offsetof(struct ip_header, ip_src));
+        break;
+    case ETH_P_IPV6:
+        if (!gro->tso6 || size < ETH_HLEN + IP6_HLEN + TCP_HLEN ||
+            (ip[0] >> 4) != 6 ||
+            ((const struct ip6_header *)ip)->ip6_nxt != IP_PROTO_TCP) {
+            return false;
+        }
+        seg->ipv6 = true;
+        seg->l4_off = ETH_HLEN + IP6_HLEN;
+        seg->size = seg->l4_off +
+                    lduw_be_p(&((const struct ip6_header *)ip)->ip6_plen);
+        sum = net_checksum_add(32, (uint8_t *)ip +
+                               offsetof(struct ip6_header, ip6_src));
+        break;
+    default:
+        return false;
+    }
+
+    if (seg->size < seg->l4_off + TCP_HLEN || seg->size > size) {
+        return false;
+    }
+
+    tcp = buf + seg->l4_off;
+    l4_len = seg->size - seg->l4_off;
+    tcp_hlen = TCP_HEADER_DATA_OFFSET((const struct tcp_header *)tcp);
+    if (tcp_hlen < TCP_HLEN || tcp_hlen > l4_len) {
+        return false;
+    }
+
+    /* Segments are only merged if their checksum is correct */
+    sum += IP_PROTO_TCP + l4_len;
+    sum += net_checksum_add(l4_len, (uint8_t *)tcp);
+    if (net_checksum_finish(sum)) {
+        return false;
+    }
+
+    seg->hdr_len = seg->l4_off + tcp_hlen;
+    seg->payload = seg->size - seg->hdr_len;
+    seg->seq = ldl_be_p(tcp + offsetof(struct tcp_header, th_seq));
+    seg->flags = tcp[TCP_FLAGS_OFFSET];
+    return true;
+}
+
+static NetGROFlow *net_gro_find_flow(NetGRO *gro, const uint8_t *buf,
+                                     const NetGROSegment *seg)
+{
+    /* Addresses are contiguous, and so are the ports */
+    size_t addr_off = seg->ipv6 ?
+        ETH_HLEN + offsetof(struct ip6_header, ip6_src) :
+        ETH_HLEN + offsetof(struct ip_header, ip_src);
+    size_t addr_len = seg->ipv6 ? 32 : 8;
+    unsigned int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        NetGROFlow *flow = &gro->flows[i];
+
+        if (flow->active && flow->ipv6 == seg->ipv6 &&
+            !memcmp(flow->buf + addr_off, buf + addr_off, addr_len) &&
+            !memcmp(flow->buf + flow->l4_off, buf + seg->l4_off, 4)) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+static bool net_gro_can_merge(const NetGROFlow *flow, const uint8_t *buf,
+                              const NetGROSegment *seg)
+{
+    const uint8_t *ip = buf + ETH_HLEN;
+    const uint8_t *fip = flow->buf + ETH_HLEN;
+    const uint8_t *tcp = buf + seg->l4_off;
+    const uint8_t *ftcp = flow->buf + flow->l4_off;
+
+    if (flow->closed ||
+        (seg->flags & ~TCP_FLAG_PSH) != TCP_FLAG_ACK ||
+        !seg->payload || seg->payload > flow->mss ||
+        seg->seq != flow->next_seq ||
+        seg->hdr_len != flow->hdr_len ||
+        flow->size + seg->payload > NET_GRO_MAX_SIZE) {
+        return false;
+    }
+
+    if (seg->ipv6) {
+        /* Version, traffic class and flow label; hop limit */
+        if (memcmp(ip, fip, 4) || ip[7] != fip[7]) {
+            return false;
+        }
+    } else {
+        /* TOS; fragment flags; TTL */
+        if (ip[1] != fip[1] || memcmp(ip + 6, fip + 6, 3)) {
+            return false;
+        }
+    }
+
+    /* Acknowledgment, data offset, window, urgent pointer and options */
+    return !memcmp(tcp + 8, ftcp + 8, 5) &&
+           !memcmp(tcp + 14, ftcp + 14, 2) &&
+           !memcmp(tcp + 18, ftcp + 18, seg->hdr_len - seg->l4_off - 18);
+}
+
+static bool net_gro_flush_flow(NetGRO *gro, NetGROFlow *flow)
+{
+    struct virtio_net_hdr hdr = { 0 };
+    uint8_t *ip = flow->buf + ETH_HLEN;
+
+    if (flow->segs > 1) {
+        if (flow->ipv6) {
+            stw_be_p(ip + offsetof(struct ip6_header, ip6_plen),
+                     flow->size - ETH_HLEN - IP6_HLEN);
+        } else {
+            stw_be_p(ip + offsetof(struct ip_header, ip_len),
+                     flow->size - ETH_HLEN);
+            stw_be_p(ip + offsetof(struct ip_header, ip_sum), 0);
+            stw_be_p(ip + offsetof(struct ip_header, ip_sum),
+                     net_raw_checksum(ip, IP4_HLEN));
+        }
+
+        hdr.flags = VIRTIO_NET_HDR_F_DATA_VALID;
+        hdr.gso_type = flow->ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 :
+                                    VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr.gso_size = flow->mss;
+        hdr.hdr_len = flow->hdr_len;
+    }
+
+    if (!gro->deliver(gro->opaque, flow->segs > 1 ? &hdr : NULL,
+                      flow->buf, flow->size)) {
+        return false;
+    }
+    flow->active = false;
+    return true;
+}
+
+static NetGROFlow *net_gro_new_flow(NetGRO *gro)
+{
+    NetGROFlow *flow;
+    unsigned int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (!gro->flows[i].active) {
+            flow = &gro->flows[i];
+            goto found;
+        }
+    }
+
+    /* All slots are in use, evict them in turn */
+    flow = &gro->flows[gro->next_evict];
+    if (!net_gro_flush_flow(gro, flow)) {
+        return NULL;
+    }
+    gro->next_evict = (gro->next_evict + 1) % NET_GRO_MAX_FLOWS;
+
+found:
+    if (!flow->buf) {
+        flow->buf = g_malloc(NET_GRO_MAX_SIZE);
+    }
+    return flow;
+}
+
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size)
+{
+    NetGROSegment seg;
+    NetGROFlow *flow;
+
+    if (!net_gro_parse(gro, buf, size, &seg)) {
+        return gro->deliver(gro->opaque, NULL, buf, size);
+    }
+
+    flow = net_gro_find_flow(gro, buf, &seg);
+    if (flow) {
+        if (net_gro_can_merge(flow, buf, &seg)) {
+            memcpy(flow->buf + flow->size, buf + seg.hdr_len, seg.payload);
+            flow->size += seg.payload;
+            flow->next_seq += seg.payload;
+            flow->segs++;
+            flow->buf[flow->l4_off + TCP_FLAGS_OFFSET] |= seg.flags;
+
+            /*
+             * The frame ends here.  If it cannot go now, it goes later,
+             * but nothing else may be appended to it in the meantime.
+             */
+            if ((seg.flags & TCP_FLAG_PSH) || seg.payload < flow->mss) {
+                flow->closed = !net_gro_flush_flow(gro, flow);
+            }
+            return size;
+        }
+
+        /* Whatever breaks the sequence goes after the data held so far */
+        if (!net_gro_flush_flow(gro, flow)) {
+            return 0;
+        }
+    }
+
+    /* Only hold data segments that can be continued */
+    if (seg.flags != TCP_FLAG_ACK || !seg.payload) {
+        return gro->deliver(gro->opaque, NULL, buf, size);
+    }
+
+    flow = net_gro_new_flow(gro);
+    if (!flow) {
+        return 0;
+    }
+
+    memcpy(flow->buf, buf, seg.size);
+    flow->active = true;
+    flow->closed = false;
+    flow->ipv6 = seg.ipv6;
+    flow->size = seg.size;
+    flow->l4_off = seg.l4_off;
+    flow->hdr_len = seg.hdr_len;
+    flow->next_seq = seg.seq + seg.payload;
+    flow->mss = seg.payload;
+    flow->segs = 1;
+    return size;
+}
+
+bool net_gro_flush(NetGRO *gro)
+{
+    bool done = true;
+    unsigned int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (gro->flows[i].active && !net_gro_flush_flow(gro, &gro->flows[i])) {
+            done = false;
+        }
+    }
+    return done;
+}
+
+bool net_gro_has_pending(NetGRO *gro)
+{
+    unsigned int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (gro->flows[i].active) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void net_gro_purge(NetGRO *gro)
+{
+    unsigned int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        gro->flows[i].active = false;
+    }
+}
@@ -894,6 +894,51 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                    iov, iovcnt, sent_cb);
 }
 
+/*
+ * Send a burst of packets.  When neither side has filters and nothing is
+ * queued for the peer, the packets are handed to the peer's
+ * receive_iov_batch callback in one call; otherwise, or for whatever the
+ * peer did not consume, they go one at a time through
+ * qemu_sendv_packet_async().
+ *
+ * Returns the number of packets that were sent or dropped.  If this is less
+ * than @count, the packet at that index was queued and @sent_cb will be
+ * called for it; the packets after it were not looked at.
+ */
+int qemu_sendv_packet_batch_async(NetClientState *sender,
+                                  const NetPacketIOV *pkts, int count,
+                                  NetPacketSent *sent_cb)
+{
+    NetClientState *peer = sender->peer;
+    int i = 0;
+
+    if (!sender->link_down && peer && !peer->link_down &&
+        peer->info->receive_iov_batch &&
+        QTAILQ_EMPTY(&sender->filters) && QTAILQ_EMPTY(&peer->filters) &&
+        qemu_net_queue_is_idle(peer->incoming_queue) &&
+        qemu_can_send_packet(sender)) {
+        int n;
+
+        /* Oversized packets are dropped by qemu_sendv_packet_async() */
+        for (n = 0; n < count; n++) {
+            if (iov_size(pkts[n].iov, pkts[n].iovcnt) > NET_BUFSIZE) {
+                break;
+            }
+        }
+        if (n) {
+            i = peer->info->receive_iov_batch(peer, pkts, n);
+        }
+    }
+
+    for (; i < count; i++) {
+        if (qemu_sendv_packet_async(sender, pkts[i].iov, pkts[i].iovcnt,
+                                    sent_cb) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
 ssize_t
 qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
 {
@@ -1573,6 +1618,68 @@ RxFilterInfoList *qmp_query_rx_filter(const char *name, Error **errp)
     return filter_list;
 }
 
+/* Flow steering is configured per NIC, i.e. on queue 0 */
+static NetClientState *net_flow_steering_nic(const char *name, Error **errp)
+{
+    NetClientState *nc;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        if (nc->queue_index != 0 || strcmp(nc->name, name) != 0) {
+            continue;
+        }
+        if (nc->info->type != NET_CLIENT_DRIVER_NIC) {
+            error_setg(errp, "net client(%s) isn't a NIC", name);
+            return NULL;
+        }
+        if (!nc->info->query_flow_steering) {
+            error_setg(errp, "net client(%s) doesn't support flow steering",
+                       name);
+            return NULL;
+        }
+        return nc;
+    }
+
+    error_setg(errp, "invalid net client name: %s", name);
+    return NULL;
+}
+
+void qmp_x_net_flow_rule_add(const char *name, NetFlowRule *rule,
+                             Error **errp)
+{
+    NetClientState *nc = net_flow_steering_nic(name, errp);
+
+    if (nc) {
+        nc->info->flow_rule_add(nc, rule, errp);
+    }
+}
+
+void qmp_x_net_flow_rule_del(const char *name, uint32_t id, Error **errp)
+{
+    NetClientState *nc = net_flow_steering_nic(name, errp);
+
+    if (nc) {
+        nc->info->flow_rule_del(nc, id, errp);
+    }
+}
+
+void qmp_x_net_flow_steering_set(const char *name, bool automatic,
+                                 Error **errp)
+{
+    NetClientState *nc = net_flow_steering_nic(name, errp);
+
+    if (nc) {
+        nc->info->flow_steering_set(nc, automatic, errp);
+    }
+}
+
+NetFlowSteeringInfo *qmp_x_query_net_flow_steering(const char *name,
+                                                   Error **errp)
+{
+    NetClientState *nc = net_flow_steering_nic(name, errp);
+
+    return nc ? nc->info->query_flow_steering(nc) : NULL;
+}
+
 void colo_notify_filters_event(int event, Error **errp)
 {
     NetClientState *nc;
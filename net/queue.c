@@ -302,3 +302,9 @@ bool qemu_net_queue_flush(NetQueue *queue)
     }
     return true;
 }
+
+/* Returns true if nothing is queued or being delivered to the receiver. */
+bool qemu_net_queue_is_idle(NetQueue *queue)
+{
+    return !queue->delivering && QTAILQ_EMPTY(&queue->packets);
+}
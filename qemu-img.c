@@ -2200,7 +2200,7 @@ static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst,
                                    true, bdrv_dirty_bitmap_granularity(bm),
                                    true, true,
                                    true, !bdrv_dirty_bitmap_enabled(bm),
-                                   &err);
+                                   false, false, &err);
         if (err) {
             error_reportf_err(err, "Failed to create bitmap %s: ", name);
             return -1;
@@ -4932,7 +4932,7 @@ static int img_bitmap(int argc, char **argv)
         case BITMAP_ADD:
             qmp_block_dirty_bitmap_add(bs->node_name, bitmap,
                                        !!granularity, granularity, true, true,
-                                       false, false, &err);
+                                       false, false, false, false, &err);
             op = "add";
             break;
         case BITMAP_REMOVE:
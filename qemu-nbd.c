@@ -26,6 +26,7 @@
 #include "qemu/cutils.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/runstate.h" /* for qemu_system_killed() prototype */
+#include "sysemu/iothread.h"
 #include "block/block_int.h"
 #include "block/nbd.h"
 #include "qemu/main-loop.h"
@@ -70,6 +71,8 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_IOTHREADS     268
+#define QEMU_NBD_OPT_ZERO_COPY_SEND 269
 
 #define MBR_SIZE 512
 
@@ -80,6 +83,10 @@ static int nb_fds;
 static QIONetListener *server;
 static QCryptoTLSCreds *tlscreds;
 static const char *tlsauthz;
+static int nr_iothreads;
+static IOThread **iothreads;
+static int next_iothread;
+static bool zero_copy_send;
 
 static void usage(const char *name)
 {
@@ -98,6 +105,8 @@ static void usage(const char *name)
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
 "  -t, --persistent          don't exit on the last connection\n"
+"      --iothreads=NUM       serve client connections from NUM threads\n"
+"      --zero-copy-send      send large read replies with MSG_ZEROCOPY\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
 "  -D, --description=TEXT    export a human-readable description\n"
@@ -384,13 +393,21 @@ static void nbd_client_closed(NBDClient *client, bool negotiated)
 static void nbd_accept(QIONetListener *listener, QIOChannelSocket *cioc,
                        gpointer opaque)
 {
+    AioContext *ctx = NULL;
+
     if (state >= TERMINATE) {
         return;
     }
 
+    if (nr_iothreads) {
+        ctx = iothread_get_aio_context(iothreads[next_iothread]);
+        next_iothread = (next_iothread + 1) % nr_iothreads;
+    }
+
     nb_fds++;
     nbd_update_server_watch();
-    nbd_client_new(cioc, tlscreds, tlsauthz, nbd_client_closed);
+    nbd_client_new(cioc, ctx, zero_copy_send, tlscreds, tlsauthz,
+                   nbd_client_closed);
 }
 
 static void nbd_update_server_watch(void)
@@ -519,11 +536,29 @@ static const char *socket_activation_validate_opts(const char *device,
     return NULL;
 }
 
+static void qemu_nbd_create_iothreads(void)
+{
+    int i;
+
+    iothreads = g_new(IOThread *, nr_iothreads);
+    for (i = 0; i < nr_iothreads; i++) {
+        g_autofree char *id = g_strdup_printf("qemu-nbd-iothread%d", i);
+
+        iothreads[i] = iothread_create(id, &error_fatal);
+    }
+}
+
 static void qemu_nbd_shutdown(void)
 {
+    int i;
+
     job_cancel_sync_all();
     blk_exp_close_all();
     bdrv_close_all();
+
+    for (i = 0; iothreads && i < nr_iothreads; i++) {
+        iothread_destroy(iothreads[i]);
+    }
 }
 
 int main(int argc, char **argv)
@@ -561,6 +596,8 @@ int main(int argc, char **argv)
         { "detect-zeroes", required_argument, NULL,
           QEMU_NBD_OPT_DETECT_ZEROES },
         { "shared", required_argument, NULL, 'e' },
+        { "iothreads", required_argument, NULL, QEMU_NBD_OPT_IOTHREADS },
+        { "zero-copy-send", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY_SEND },
         { "format", required_argument, NULL, 'f' },
         { "persistent", no_argument, NULL, 't' },
         { "verbose", no_argument, NULL, 'v' },
@@ -747,6 +784,16 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             break;
+        case QEMU_NBD_OPT_IOTHREADS:
+            if (qemu_strtoi(optarg, NULL, 0, &nr_iothreads) < 0 ||
+                nr_iothreads < 0) {
+                error_report("Invalid number of IOThreads '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case QEMU_NBD_OPT_ZERO_COPY_SEND:
+            zero_copy_send = true;
+            break;
         case 'f':
             fmt = optarg;
             break;
@@ -1151,6 +1198,9 @@ int main(int argc, char **argv)
 
     nbd_server_is_qemu_nbd(shared);
 
+    /* Threads do not survive --fork, so only create them now */
+    qemu_nbd_create_iothreads();
+
     export_opts = g_new(BlockExportOptions, 1);
     *export_opts = (BlockExportOptions) {
         .type               = BLOCK_EXPORT_TYPE_NBD,
@@ -50,6 +50,14 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/*
+ * Regions changed by the current transaction.  On commit, only the FlatViews
+ * that include one of them are rendered again, unless
+ * memory_region_update_all is set.
+ */
+static GHashTable *memory_region_changes;
+static bool memory_region_update_all;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -941,10 +949,15 @@ static void flat_range_coalesced_io_add(FlatRange *fr, AddressSpace *as)
     }
 }
 
+/*
+ * @batch, if not NULL, collects the sections removed (or added, if @adding)
+ * for #MemoryListener.region_update().
+ */
 static void address_space_update_topology_pass(AddressSpace *as,
                                                const FlatView *old_view,
                                                const FlatView *new_view,
-                                               bool adding)
+                                               bool adding,
+                                               GArray *batch)
 {
     unsigned iold, inew;
     FlatRange *frold, *frnew;
@@ -975,6 +988,11 @@ static void address_space_update_topology_pass(AddressSpace *as,
             if (!adding) {
                 flat_range_coalesced_io_del(frold, as);
                 MEMORY_LISTENER_UPDATE_REGION(frold, as, Reverse, region_del);
+                if (batch) {
+                    MemoryRegionSection mrs = section_from_flat_range(frold,
+                            address_space_to_flatview(as));
+                    g_array_append_val(batch, mrs);
+                }
             }
 
             ++iold;
@@ -1003,6 +1021,11 @@ static void address_space_update_topology_pass(AddressSpace *as,
             if (adding) {
                 MEMORY_LISTENER_UPDATE_REGION(frnew, as, Forward, region_add);
                 flat_range_coalesced_io_add(frnew, as);
+                if (batch) {
+                    MemoryRegionSection mrs = section_from_flat_range(frnew,
+                            address_space_to_flatview(as));
+                    g_array_append_val(batch, mrs);
+                }
             }
 
             ++inew;
@@ -1010,6 +1033,36 @@ static void address_space_update_topology_pass(AddressSpace *as,
     }
 }
 
+static bool address_space_has_region_update(AddressSpace *as)
+{
+    MemoryListener *listener;
+
+    QTAILQ_FOREACH(listener, &as->listeners, link_as) {
+        if (listener->region_update) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void address_space_region_update(AddressSpace *as,
+                                        GArray *del, GArray *add)
+{
+    MemoryListener *listener;
+
+    if (!del->len && !add->len) {
+        return;
+    }
+
+    QTAILQ_FOREACH(listener, &as->listeners, link_as) {
+        if (listener->region_update) {
+            listener->region_update(listener,
+                                    (MemoryRegionSection *)del->data, del->len,
+                                    (MemoryRegionSection *)add->data, add->len);
+        }
+    }
+}
+
 static void flatviews_init(void)
 {
     static FlatView *empty_view;
@@ -1030,28 +1083,93 @@ static void flatviews_init(void)
     }
 }
 
-static void flatviews_reset(void)
+static void memory_region_note_change(MemoryRegion *mr)
 {
-    AddressSpace *as;
+    if (!memory_region_changes) {
+        memory_region_changes = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_add(memory_region_changes, mr);
+}
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+/*
+ * Returns true if a region reachable from @mr, disabled or not, changed.
+ * @visited avoids walking the same subtree twice through aliases.
+ */
+static bool memory_region_subtree_changed(MemoryRegion *mr,
+                                          GHashTable *visited)
+{
+    MemoryRegion *subregion;
+
+    if (!g_hash_table_add(visited, mr)) {
+        return false;
+    }
+    if (g_hash_table_contains(memory_region_changes, mr)) {
+        return true;
+    }
+    if (mr->alias) {
+        return memory_region_subtree_changed(mr->alias, visited);
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (memory_region_subtree_changed(subregion, visited)) {
+            return true;
+        }
     }
+    return false;
+}
+
+static bool flatview_needs_update(MemoryRegion *physmr)
+{
+    g_autoptr(GHashTable) visited = NULL;
+
+    if (memory_region_update_all) {
+        return true;
+    }
+    if (!physmr || !memory_region_changes) {
+        return false;
+    }
+    visited = g_hash_table_new(NULL, NULL);
+    return memory_region_subtree_changed(physmr, visited);
+}
+
+/* Render the FVs affected by the changes, and keep the others */
+static void flatviews_update(void)
+{
+    GHashTable *old_views = flat_views;
+    AddressSpace *as;
+
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && !flatview_needs_update(physmr)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+        } else {
+            generate_memory_topology(physmr);
+        }
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
+static void memory_region_changes_reset(void)
+{
+    if (memory_region_changes) {
+        g_hash_table_remove_all(memory_region_changes);
+    }
+    memory_region_update_all = false;
+}
+
 static void address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
@@ -1061,6 +1179,16 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /*
+         * The view was reused because nothing in it changed.  Listeners
+         * such as vhost rebuild their state from scratch between begin and
+         * commit, so replay region_nop for every section as for any other
+         * range that did not change.
+         */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, new_view, new_view, true,
+                                               NULL);
+        }
         return;
     }
 
@@ -1072,12 +1200,21 @@ static void address_space_set_flatview(AddressSpace *as)
 
     if (!QTAILQ_EMPTY(&as->listeners)) {
         FlatView tmpview = { .nr = 0 }, *old_view2 = old_view;
+        g_autoptr(GArray) del = NULL;
+        g_autoptr(GArray) add = NULL;
 
         if (!old_view2) {
             old_view2 = &tmpview;
         }
-        address_space_update_topology_pass(as, old_view2, new_view, false);
-        address_space_update_topology_pass(as, old_view2, new_view, true);
+        if (address_space_has_region_update(as)) {
+            del = g_array_new(false, false, sizeof(MemoryRegionSection));
+            add = g_array_new(false, false, sizeof(MemoryRegionSection));
+        }
+        address_space_update_topology_pass(as, old_view2, new_view, false, del);
+        address_space_update_topology_pass(as, old_view2, new_view, true, add);
+        if (del) {
+            address_space_region_update(as, del, add);
+        }
     }
 
     /* Writes are protected by the BQL.  */
@@ -1124,13 +1261,18 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatviews_update();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (ioeventfd_update_pending ||
+                    address_space_to_flatview(as) != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -1141,6 +1283,7 @@ void memory_region_transaction_commit(void)
             }
             ioeventfd_update_pending = false;
         }
+        memory_region_changes_reset();
    }
 }
 
@@ -2257,6 +2400,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
     memory_region_update_pending |= mr->enabled;
+    memory_region_note_change(mr);
     memory_region_transaction_commit();
 }
 
@@ -2387,6 +2531,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
         memory_region_transaction_begin();
         mr->readonly = readonly;
         memory_region_update_pending |= mr->enabled;
+        memory_region_note_change(mr);
         memory_region_transaction_commit();
     }
 }
@@ -2397,6 +2542,7 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
         memory_region_update_pending |= mr->enabled;
+        memory_region_note_change(mr);
         memory_region_transaction_commit();
     }
 }
@@ -2407,6 +2553,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
         memory_region_update_pending |= mr->enabled;
+        memory_region_note_change(mr);
         memory_region_transaction_commit();
     }
 }
@@ -2643,6 +2790,8 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
     memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_note_change(mr);
+    memory_region_note_change(subregion);
     memory_region_transaction_commit();
 }
 
@@ -2693,6 +2842,8 @@ void memory_region_del_subregion(MemoryRegion *mr,
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
     memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_note_change(mr);
+    memory_region_note_change(subregion);
     memory_region_transaction_commit();
 }
 
@@ -2704,6 +2855,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     memory_region_transaction_begin();
     mr->enabled = enabled;
     memory_region_update_pending = true;
+    memory_region_note_change(mr);
     memory_region_transaction_commit();
 }
 
@@ -2720,6 +2872,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     memory_region_transaction_begin();
     mr->size = s;
     memory_region_update_pending = true;
+    memory_region_note_change(mr);
     memory_region_transaction_commit();
 }
 
@@ -2756,6 +2909,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
     memory_region_transaction_begin();
     mr->alias_offset = offset;
     memory_region_update_pending |= mr->enabled;
+    memory_region_note_change(mr);
     memory_region_transaction_commit();
 }
 
@@ -2768,6 +2922,7 @@ void memory_region_set_unmergeable(MemoryRegion *mr, bool unmergeable)
     memory_region_transaction_begin();
     mr->unmergeable = unmergeable;
     memory_region_update_pending |= mr->enabled;
+    memory_region_note_change(mr);
     memory_region_transaction_commit();
 }
 
@@ -2939,6 +3094,7 @@ void memory_global_dirty_log_start(unsigned int flags)
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
         memory_region_update_pending = true;
+        memory_region_update_all = true;
         memory_region_transaction_commit();
     }
 }
@@ -2954,6 +3110,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
         memory_region_update_pending = true;
+        memory_region_update_all = true;
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -3004,6 +3161,17 @@ void memory_global_dirty_log_stop(unsigned int flags)
     memory_global_dirty_log_do_stop(flags);
 }
 
+static MemoryRegionSection *flatview_sections(FlatView *view)
+{
+    MemoryRegionSection *sections = g_new(MemoryRegionSection, view->nr);
+    unsigned i;
+
+    for (i = 0; i < view->nr; i++) {
+        sections[i] = section_from_flat_range(&view->ranges[i], view);
+    }
+    return sections;
+}
+
 static void listener_add_address_space(MemoryListener *listener,
                                        AddressSpace *as)
 {
@@ -3020,6 +3188,11 @@ static void listener_add_address_space(MemoryListener *listener,
     }
 
     view = address_space_get_flatview(as);
+    if (listener->region_update && view->nr) {
+        g_autofree MemoryRegionSection *sections = flatview_sections(view);
+
+        listener->region_update(listener, NULL, 0, sections, view->nr);
+    }
     FOR_EACH_FLAT_RANGE(fr, view) {
         MemoryRegionSection section = section_from_flat_range(fr, view);
 
@@ -3056,6 +3229,11 @@ static void listener_del_address_space(MemoryListener *listener,
             listener->region_del(listener, &section);
         }
     }
+    if (listener->region_update && view->nr) {
+        g_autofree MemoryRegionSection *sections = flatview_sections(view);
+
+        listener->region_update(listener, sections, view->nr, NULL, 0);
+    }
     if (listener->commit) {
         listener->commit(listener);
     }
@@ -3068,6 +3246,8 @@ void memory_listener_register(MemoryListener *listener, AddressSpace *as)
 
     /* Only one of them can be defined for a listener */
     assert(!(listener->log_sync && listener->log_sync_global));
+    assert(!(listener->region_update &&
+             (listener->region_add || listener->region_del)));
 
     listener->address_space = as;
     if (QTAILQ_EMPTY(&memory_listeners)
@@ -204,6 +204,13 @@ typedef enum {
 #define TCG_TARGET_HAS_v64              have_avx1
 #define TCG_TARGET_HAS_v128             have_avx1
 #define TCG_TARGET_HAS_v256             have_avx2
+/*
+ * Only a subset of the vector opcodes is implemented for v512,
+ * see tcg_can_emit_vec_op.  AVX512BW is required for the byte and
+ * word element forms of the basic arithmetic.
+ */
+#define TCG_TARGET_HAS_v512 \
+    (TCG_TARGET_REG_BITS == 64 && have_avx512bw)
 
 #define TCG_TARGET_HAS_andc_vec         1
 #define TCG_TARGET_HAS_orc_vec          have_avx512vl
@@ -1685,6 +1685,7 @@ TCGTemp *tcg_temp_new_internal(TCGType type, TCGTempKind kind)
     case TCG_TYPE_V64:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         n = 1;
         break;
     case TCG_TYPE_I64:
@@ -1776,6 +1777,9 @@ TCGv_vec tcg_temp_new_vec(TCGType type)
     case TCG_TYPE_V256:
         assert(TCG_TARGET_HAS_v256);
         break;
+    case TCG_TYPE_V512:
+        assert(TCG_TARGET_HAS_v512);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -1949,7 +1953,8 @@ TCGTemp *tcgv_i32_temp(TCGv_i32 v)
 bool tcg_op_supported(TCGOpcode op)
 {
     const bool have_vec
-        = TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 | TCG_TARGET_HAS_v256;
+        = (TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128 |
+           TCG_TARGET_HAS_v256 | TCG_TARGET_HAS_v512);
 
     switch (op) {
     case INDEX_op_discard:
@@ -2427,6 +2432,7 @@ static void tcg_reg_alloc_start(TCGContext *s)
     }
 
     memset(s->reg_to_temp, 0, sizeof(s->reg_to_temp));
+    s->alloc_op = NULL;
 }
 
 static char *tcg_get_arg_str_ptr(TCGContext *s, char *buf, int buf_size,
@@ -2458,6 +2464,7 @@ static char *tcg_get_arg_str_ptr(TCGContext *s, char *buf, int buf_size,
         case TCG_TYPE_V64:
         case TCG_TYPE_V128:
         case TCG_TYPE_V256:
+        case TCG_TYPE_V512:
             snprintf(buf, buf_size, "v%d$0x%" PRIx64,
                      64 << (ts->type - TCG_TYPE_V64), ts->val);
             break;
@@ -4125,8 +4132,9 @@ static void temp_allocate_frame(TCGContext *s, TCGTemp *ts)
     case TCG_TYPE_I128:
     case TCG_TYPE_V128:
     case TCG_TYPE_V256:
+    case TCG_TYPE_V512:
         /*
-         * Note that we do not require aligned storage for V256,
+         * Note that we do not require aligned storage for V256 or V512,
          * and that we provide alignment for I128 to match V128,
          * even if that's above what the host ABI requires.
          */
@@ -4291,6 +4299,119 @@ static void tcg_reg_free(TCGContext *s, TCGReg reg, TCGRegSet allocated_regs)
     }
 }
 
+/*
+ * For TBs with at least TCG_SPILL_LOOKAHEAD_MIN_OPS ops, choose spill
+ * victims by scanning up to TCG_SPILL_LOOKAHEAD ops ahead for the next
+ * read of each candidate.  Smaller TBs rarely run out of registers and
+ * keep the cheaper allocation-order choice.
+ */
+#define TCG_SPILL_LOOKAHEAD_MIN_OPS  128
+#define TCG_SPILL_LOOKAHEAD          64
+
+/* Record that the temp in a register of @pending is next used at @dist. */
+static void tcg_spill_mark(TCGContext *s, TCGRegSet *pending, int *dist,
+                           TCGTemp *ts, int d)
+{
+    if (ts->val_type == TEMP_VAL_REG
+        && tcg_regset_test_reg(*pending, ts->reg)
+        && s->reg_to_temp[ts->reg] == ts) {
+        dist[ts->reg] = d;
+        tcg_regset_reset_reg(*pending, ts->reg);
+    }
+}
+
+/**
+ * tcg_reg_pick_spill:
+ * @set: Set of registers, all currently holding a temp, to choose from.
+ * @order: Register allocation order.
+ *
+ * Return the register in @set whose temp is next read furthest in the
+ * future, following s->alloc_op.  The inputs of s->alloc_op itself that
+ * are not yet in their allocated register are read at distance 0.  A temp
+ * that is overwritten or discarded before it is read, or not read before
+ * the end of the basic block, costs at most a store to spill and is
+ * preferred.  Ties prefer temps which are already coherent with memory,
+ * and then allocation order.
+ *
+ * Splitting the live range of the victim here, and reloading it with
+ * temp_load at its next use, approximates the furthest-next-use spill
+ * heuristic of a linear-scan allocator within the single-pass allocator.
+ */
+static TCGReg tcg_reg_pick_spill(TCGContext *s, TCGRegSet set,
+                                 const int *order, int n)
+{
+    int dist[TCG_TARGET_NB_REGS];
+    TCGRegSet pending = set;
+    TCGOp *op = s->alloc_op;
+    int best = -1;
+    int i, k, best_dist = -1;
+    bool best_coherent = false;
+
+    for (k = 0; pending && k <= TCG_SPILL_LOOKAHEAD;
+         k++, op = QTAILQ_NEXT(op, link)) {
+        const TCGOpDef *def;
+        int nb_oargs, nb_iargs;
+
+        if (op == NULL || (k && op->opc == INDEX_op_set_label)) {
+            break;
+        }
+        switch (op->opc) {
+        case INDEX_op_insn_start:
+            continue;
+        case INDEX_op_discard:
+            tcg_spill_mark(s, &pending, dist, arg_temp(op->args[0]), INT_MAX);
+            continue;
+        case INDEX_op_call:
+            nb_oargs = TCGOP_CALLO(op);
+            nb_iargs = TCGOP_CALLI(op);
+            break;
+        default:
+            def = &tcg_op_defs[op->opc];
+            nb_oargs = def->nb_oargs;
+            nb_iargs = def->nb_iargs;
+            break;
+        }
+
+        /* Inputs are read before outputs are written. */
+        for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+            tcg_spill_mark(s, &pending, dist, arg_temp(op->args[i]), k);
+        }
+        /* The outputs of the current op are what is being allocated. */
+        if (k) {
+            for (i = 0; i < nb_oargs; i++) {
+                tcg_spill_mark(s, &pending, dist, arg_temp(op->args[i]),
+                               INT_MAX);
+            }
+        }
+        /* A conditional branch falls through within the same ebb. */
+        if ((tcg_op_defs[op->opc].flags
+             & (TCG_OPF_BB_END | TCG_OPF_COND_BRANCH)) == TCG_OPF_BB_END) {
+            break;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        TCGReg reg = order[i];
+        TCGTemp *ts;
+        bool coherent;
+        int d;
+
+        if (!tcg_regset_test_reg(set, reg)) {
+            continue;
+        }
+        ts = s->reg_to_temp[reg];
+        d = tcg_regset_test_reg(pending, reg) ? INT_MAX : dist[reg];
+        coherent = ts->kind == TEMP_CONST || ts->mem_coherent;
+        if (d > best_dist || (d == best_dist && coherent && !best_coherent)) {
+            best = reg;
+            best_dist = d;
+            best_coherent = coherent;
+        }
+    }
+    tcg_debug_assert(best >= 0);
+    return best;
+}
+
 /**
  * tcg_reg_alloc:
  * @required_regs: Set of registers in which we must allocate.
@@ -4349,6 +4470,10 @@ static TCGReg tcg_reg_alloc(TCGContext *s, TCGRegSet required_regs,
             TCGReg reg = tcg_regset_first(set);
             tcg_reg_free(s, reg, allocated_regs);
             return reg;
+        } else if (s->alloc_op) {
+            TCGReg reg = tcg_reg_pick_spill(s, set, order, n);
+            tcg_reg_free(s, reg, allocated_regs);
+            return reg;
         } else {
             for (i = 0; i < n; i++) {
                 TCGReg reg = order[i];
@@ -6075,6 +6200,7 @@ static void tcg_out_st_helper_args(TCGContext *s, const TCGLabelQemuLdst *ldst,
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 {
     int i, start_words, num_insns;
+    bool lookahead;
     TCGOp *op;
 
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP)
@@ -6171,9 +6297,12 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     tcg_out_tb_start(s);
 
     num_insns = -1;
+    lookahead = s->nb_ops >= TCG_SPILL_LOOKAHEAD_MIN_OPS;
     QTAILQ_FOREACH(op, &s->ops, link) {
         TCGOpcode opc = op->opc;
 
+        s->alloc_op = lookahead ? op : NULL;
+
         switch (opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
@@ -0,0 +1,199 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * aio_poll() throughput with many EventNotifiers, as used by an IOThread
+ * that serves the ioeventfds of many virtqueues.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/processor.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "block/aio.h"
+#include "qapi/error.h"
+
+struct notifier {
+    EventNotifier e;
+    uint64_t events;
+};
+
+static AioContext *ctx;
+static QemuThread *threads;
+static struct notifier *notifiers;
+static unsigned int n_notifiers = 256;
+static unsigned int n_threads = 1;
+static unsigned int n_ready_threads;
+static unsigned int duration = 1;
+static int64_t poll_max_ns;
+static uint64_t n_polls;
+static bool test_start;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -n = number of EventNotifiers\n"
+    " -t = number of threads setting them\n"
+    " -d = duration in seconds\n"
+    " -p = maximum busy polling time in ns (default 0, disabled)";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void notifier_read(EventNotifier *e)
+{
+    struct notifier *n = container_of(e, struct notifier, e);
+
+    if (event_notifier_test_and_clear(e)) {
+        n->events++;
+    }
+}
+
+static void *thread_func(void *arg)
+{
+    unsigned int i = (uintptr_t)arg;
+
+    qatomic_inc(&n_ready_threads);
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    /* Each thread sets every n_threads-th notifier, round robin */
+    while (!qatomic_read(&test_stop)) {
+        event_notifier_set(&notifiers[i].e);
+        i += n_threads;
+        if (i >= n_notifiers) {
+            i %= n_threads;
+        }
+    }
+    return NULL;
+}
+
+static void stop_cb(void *opaque)
+{
+    qatomic_set(&test_stop, true);
+}
+
+static void run_test(void)
+{
+    QEMUTimer *timer;
+    unsigned int i;
+
+    while (qatomic_read(&n_ready_threads) != n_threads) {
+        cpu_relax();
+    }
+
+    timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_MS, stop_cb, NULL);
+    timer_mod(timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                     duration * 1000);
+
+    qatomic_set(&test_start, true);
+    while (!qatomic_read(&test_stop)) {
+        aio_poll(ctx, true);
+        n_polls++;
+    }
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    timer_free(timer);
+}
+
+static void create_context(void)
+{
+    unsigned int i;
+
+    qemu_init_main_loop(&error_fatal);
+    ctx = aio_context_new(&error_fatal);
+    aio_context_set_poll_params(ctx, poll_max_ns, 0, 0, &error_fatal);
+
+    notifiers = g_new0(struct notifier, n_notifiers);
+    for (i = 0; i < n_notifiers; i++) {
+        event_notifier_init(&notifiers[i].e, false);
+        aio_set_event_notifier(ctx, &notifiers[i].e, notifier_read,
+                               NULL, NULL);
+    }
+}
+
+static void create_threads(void)
+{
+    unsigned int i;
+
+    threads = g_new(QemuThread, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_create(&threads[i], NULL, thread_func,
+                           (void *)(uintptr_t)i, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of notifiers:    %u\n", n_notifiers);
+    printf(" # of threads:      %u\n", n_threads);
+    printf(" duration:          %u\n", duration);
+    printf(" poll-max-ns:       %" PRId64 "\n", poll_max_ns);
+}
+
+static void pr_stats(void)
+{
+    unsigned long long events = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_notifiers; i++) {
+        events += notifiers[i].events;
+    }
+
+    printf("Results:\n");
+    printf("Duration:            %u s\n", duration);
+    printf(" Handler calls:      %.2f M/s\n", (double)events / duration / 1e6);
+    printf(" aio_poll() calls:   %.2f M/s\n", (double)n_polls / duration / 1e6);
+    printf(" Handlers/aio_poll:  %.2f\n",
+           n_polls ? (double)events / n_polls : 0.0);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:p:t:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_notifiers = atoi(optarg);
+            break;
+        case 'p':
+            poll_max_ns = atoll(optarg);
+            break;
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+        }
+    }
+    if (!n_notifiers || !n_threads || n_threads > n_notifiers) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    create_context();
+    create_threads();
+    run_test();
+    pr_stats();
+    return 0;
+}
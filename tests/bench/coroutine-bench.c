@@ -0,0 +1,172 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Coroutine create/enter/terminate rate, i.e. the cost of the coroutine
+ * pool, with one or more threads creating coroutines at the same time.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "qemu/processor.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+struct thread_info {
+    QemuThread thread;
+    Coroutine **cos;
+    uint64_t created;
+};
+
+static struct thread_info *threads;
+static unsigned int n_threads = 1;
+static unsigned int n_live = 1;
+static unsigned int n_ready_threads;
+static unsigned int duration = 1;
+static bool do_yield;
+static bool test_start;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -n = number of coroutines alive at a time in each thread (with -y)\n"
+    " -t = number of threads\n"
+    " -d = duration in seconds\n"
+    " -y = yield once before terminating";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void coroutine_fn co_entry(void *opaque)
+{
+    if (do_yield) {
+        qemu_coroutine_yield();
+    }
+}
+
+static void *thread_func(void *arg)
+{
+    struct thread_info *info = arg;
+    unsigned int i;
+
+    qatomic_inc(&n_ready_threads);
+    while (!qatomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    /*
+     * With -y, n_live coroutines are alive at once, so that large values of
+     * -n cycle batches through the global pool rather than the local one.
+     */
+    while (!qatomic_read(&test_stop)) {
+        for (i = 0; i < n_live; i++) {
+            info->cos[i] = qemu_coroutine_create(co_entry, NULL);
+            qemu_coroutine_enter(info->cos[i]);
+        }
+        if (do_yield) {
+            for (i = 0; i < n_live; i++) {
+                qemu_coroutine_enter(info->cos[i]);
+            }
+        }
+        info->created += n_live;
+    }
+    return NULL;
+}
+
+static void create_threads(void)
+{
+    unsigned int i;
+
+    threads = g_new0(struct thread_info, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        threads[i].cos = g_new(Coroutine *, n_live);
+        qemu_thread_create(&threads[i].thread, NULL, thread_func,
+                           &threads[i], QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void run_test(void)
+{
+    unsigned int i;
+
+    while (qatomic_read(&n_ready_threads) != n_threads) {
+        cpu_relax();
+    }
+
+    qatomic_set(&test_start, true);
+    g_usleep(duration * G_USEC_PER_SEC);
+    qatomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of threads:      %u\n", n_threads);
+    printf(" live coroutines:   %u\n", n_live);
+    printf(" duration:          %u\n", duration);
+    printf(" yield:             %s\n", do_yield ? "yes" : "no");
+}
+
+static void pr_stats(void)
+{
+    unsigned long long created = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_threads; i++) {
+        created += threads[i].created;
+    }
+
+    printf("Results:\n");
+    printf("Duration:            %u s\n", duration);
+    printf(" Coroutines:         %.2f M/s\n", (double)created / duration / 1e6);
+    printf(" Per thread:         %.2f M/s\n",
+           (double)created / n_threads / duration / 1e6);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:t:y");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_live = atoi(optarg);
+            break;
+        case 't':
+            n_threads = atoi(optarg);
+            break;
+        case 'y':
+            do_yield = true;
+            break;
+        }
+    }
+    if (!n_live || !n_threads) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    create_threads();
+    run_test();
+    pr_stats();
+    return 0;
+}
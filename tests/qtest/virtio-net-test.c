@@ -9,9 +9,11 @@
 
 #include "qemu/osdep.h"
 #include "libqtest-single.h"
+#include "qemu/bswap.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "hw/virtio/virtio-net.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
@@ -261,6 +263,198 @@ static void announce_self(void *obj, void *data, QGuestAllocator *t_alloc)
     };
 }
 
+#define FLOW_FRAME_SIZE (14 + 20 + 8 + 4)
+
+/* An Ethernet frame carrying "TEST" in UDP over IPv4 */
+static void flow_build_frame(uint8_t *buf, uint32_t src_ip, uint32_t dst_ip,
+                             uint16_t src_port, uint16_t dst_port)
+{
+    uint8_t *ip = buf + 14;
+    uint8_t *udp = ip + 20;
+
+    memset(buf, 0, FLOW_FRAME_SIZE);
+    memset(buf, 0xff, 6);
+    buf[6] = 0x52;
+    buf[7] = 0x54;
+    stw_be_p(buf + 12, 0x0800);
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, FLOW_FRAME_SIZE - 14);
+    ip[8] = 64;
+    ip[9] = 17;
+    stl_be_p(ip + 12, src_ip);
+    stl_be_p(ip + 16, dst_ip);
+
+    stw_be_p(udp, src_port);
+    stw_be_p(udp + 2, dst_port);
+    stw_be_p(udp + 4, 8 + 4);
+    memcpy(udp + 8, "TEST", 4);
+}
+
+static char *flow_nic_name(void)
+{
+    QDict *rsp, *filter;
+    QList *filters;
+    char *name;
+
+    rsp = qmp("{ 'execute': 'query-rx-filter' }");
+    filters = qdict_get_qlist(rsp, "return");
+    g_assert(filters);
+    filter = qobject_to(QDict, qlist_peek(filters));
+    g_assert(filter);
+    name = g_strdup(qdict_get_str(filter, "name"));
+    qobject_unref(rsp);
+    return name;
+}
+
+static void flow_rule_add_error(const char *name, const char *rule,
+                                const char *desc)
+{
+    QDict *rsp;
+
+    rsp = qmp("{ 'execute': 'x-net-flow-rule-add',"
+              "  'arguments': { 'name': %s, 'rule': %p } }",
+              name, qobject_from_json(rule, &error_abort));
+    g_assert(qdict_haskey(rsp, "error"));
+    g_assert_cmpstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    ==, desc);
+    qobject_unref(rsp);
+}
+
+static QDict *flow_query(const char *name)
+{
+    return qmp("{ 'execute': 'x-query-net-flow-steering',"
+               "  'arguments': { 'name': %s } }", name);
+}
+
+static void flow_steering(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *rx = net_if->queues[0];
+    QVirtQueue *tx = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    int *sv = data;
+    uint8_t frame[FLOW_FRAME_SIZE], buffer[64];
+    uint8_t hdr[VNET_HDR_SIZE] = { 0 };
+    int len = htonl(FLOW_FRAME_SIZE);
+    struct iovec iov[] = {
+        {
+            .iov_base = &len,
+            .iov_len = sizeof(len),
+        }, {
+            .iov_base = frame,
+            .iov_len = sizeof(frame),
+        },
+    };
+    uint64_t req_addr;
+    uint32_t free_head, rlen;
+    QDict *rsp, *info;
+    QList *rules;
+    char *name;
+    int ret;
+
+    name = flow_nic_name();
+
+    /* Rules */
+    rsp = qmp("{ 'execute': 'x-net-flow-rule-add',"
+              "  'arguments': { 'name': %s,"
+              "                 'rule': { 'id': 1, 'protocol': 'udp',"
+              "                           'dst-port': 1234, 'queue': 0 } } }",
+              name);
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    flow_rule_add_error(name, "{ 'id': 1, 'queue': 0 }",
+                        "flow rule 1 already exists");
+    flow_rule_add_error(name, "{ 'id': 2, 'queue': 1 }",
+                        "queue 1 is out of range");
+    flow_rule_add_error(name, "{ 'id': 3, 'dst-port': 80, 'queue': 0 }",
+                        "matching ports requires a protocol");
+    flow_rule_add_error(name, "{ 'id': 4, 'src-ip': '10.0.0.1',"
+                        "  'dst-ip': '::1', 'queue': 0 }",
+                        "source and destination address families differ");
+
+    rsp = flow_query(name);
+    info = qdict_get_qdict(rsp, "return");
+    g_assert(!qdict_get_bool(info, "auto"));
+    rules = qdict_get_qlist(info, "rules");
+    g_assert_cmpint(qlist_size(rules), ==, 1);
+    g_assert_cmpint(qdict_get_int(qobject_to(QDict, qlist_peek(rules)), "id"),
+                    ==, 1);
+    qobject_unref(rsp);
+
+    /* A transmitted flow is learnt once automatic steering is enabled */
+    rsp = qmp("{ 'execute': 'x-net-flow-steering-set',"
+              "  'arguments': { 'name': %s, 'auto': true } }", name);
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    flow_build_frame(frame, 0x0a000002, 0x0a000001, 5678, 4321);
+    req_addr = guest_alloc(t_alloc, 64);
+    memwrite(req_addr, hdr, sizeof(hdr));
+    memwrite(req_addr + VNET_HDR_SIZE, frame, sizeof(frame));
+    free_head = qvirtqueue_add(qts, tx, req_addr,
+                               VNET_HDR_SIZE + sizeof(frame), false, false);
+    qvirtqueue_kick(qts, dev, tx, free_head);
+    qvirtio_wait_used_elem(qts, dev, tx, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    guest_free(t_alloc, req_addr);
+
+    ret = recv(sv[0], &rlen, sizeof(rlen), 0);
+    g_assert_cmpint(ret, ==, sizeof(rlen));
+    g_assert_cmpint(ntohl(rlen), ==, sizeof(frame));
+    ret = recv(sv[0], buffer, sizeof(frame), 0);
+    g_assert_cmpint(ret, ==, sizeof(frame));
+    g_assert(memcmp(buffer, frame, sizeof(frame)) == 0);
+
+    rsp = flow_query(name);
+    info = qdict_get_qdict(rsp, "return");
+    g_assert(qdict_get_bool(info, "auto"));
+    g_assert_cmpint(qdict_get_int(info, "auto-flows"), ==, 1);
+    qobject_unref(rsp);
+
+    /* The reply is steered and received */
+    flow_build_frame(frame, 0x0a000001, 0x0a000002, 4321, 5678);
+    req_addr = guest_alloc(t_alloc, 64);
+    free_head = qvirtqueue_add(qts, rx, req_addr, 64, true, false);
+    qvirtqueue_kick(qts, dev, rx, free_head);
+
+    ret = iov_send(sv[0], iov, 2, 0, sizeof(len) + sizeof(frame));
+    g_assert_cmpint(ret, ==, sizeof(len) + sizeof(frame));
+
+    qvirtio_wait_used_elem(qts, dev, rx, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+    memread(req_addr + VNET_HDR_SIZE, buffer, sizeof(frame));
+    g_assert(memcmp(buffer, frame, sizeof(frame)) == 0);
+    guest_free(t_alloc, req_addr);
+
+    /* Disabling automatic steering forgets the learnt flows */
+    rsp = qmp("{ 'execute': 'x-net-flow-steering-set',"
+              "  'arguments': { 'name': %s, 'auto': false } }", name);
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    rsp = flow_query(name);
+    info = qdict_get_qdict(rsp, "return");
+    g_assert(!qdict_get_bool(info, "auto"));
+    g_assert_cmpint(qdict_get_int(info, "auto-flows"), ==, 0);
+    qobject_unref(rsp);
+
+    rsp = qmp("{ 'execute': 'x-net-flow-rule-del',"
+              "  'arguments': { 'name': %s, 'id': 1 } }", name);
+    g_assert(!qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+
+    rsp = qmp("{ 'execute': 'x-net-flow-rule-del',"
+              "  'arguments': { 'name': %s, 'id': 1 } }", name);
+    g_assert_cmpstr(qdict_get_str(qdict_get_qdict(rsp, "error"), "desc"),
+                    ==, "flow rule 1 not found");
+    qobject_unref(rsp);
+
+    g_free(name);
+}
+
 static void virtio_net_test_cleanup(void *sockets)
 {
     int *sv = sockets;
@@ -328,6 +522,7 @@ static void register_virtio_net_test(void)
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    qos_add_test("flow-steering", "virtio-net", flow_steering, &opts);
 #endif
 
     /* These tests do not need a loopback backend.  */
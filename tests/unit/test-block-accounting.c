@@ -0,0 +1,152 @@
+/*
+ * Test block device I/O accounting
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "block/accounting.h"
+#include "qapi/util.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#define NR_THREADS 12
+#define NR_REQUESTS 10000
+
+static void account_read(BlockAcctStats *stats, int64_t bytes,
+                         int64_t latency_ns, bool failed)
+{
+    BlockAcctCookie cookie;
+
+    block_acct_start(stats, &cookie, bytes, BLOCK_ACCT_READ);
+    cookie.start_time_ns -= latency_ns;
+    if (failed) {
+        block_acct_failed(stats, &cookie);
+    } else {
+        block_acct_done(stats, &cookie);
+    }
+}
+
+static void test_counters(void)
+{
+    BlockAcctStats stats = {};
+    BlockAcctCounters counters;
+
+    block_acct_init(&stats);
+    account_read(&stats, 4096, 0, false);
+    account_read(&stats, 512, 0, false);
+    account_read(&stats, 512, 0, true);
+    block_acct_invalid(&stats, BLOCK_ACCT_WRITE);
+    block_acct_merge_done(&stats, BLOCK_ACCT_READ, 3);
+
+    block_acct_get_counters(&stats, &counters);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_READ], ==, 2);
+    g_assert_cmpuint(counters.nr_bytes[BLOCK_ACCT_READ], ==, 4608);
+    g_assert_cmpuint(counters.failed_ops[BLOCK_ACCT_READ], ==, 1);
+    g_assert_cmpuint(counters.invalid_ops[BLOCK_ACCT_WRITE], ==, 1);
+    g_assert_cmpuint(counters.merged[BLOCK_ACCT_READ], ==, 3);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_WRITE], ==, 0);
+    g_assert_cmpint(counters.last_access_time_ns, >, 0);
+
+    block_acct_cleanup(&stats);
+}
+
+static uint64List *make_boundaries(void)
+{
+    uint64List *list = NULL;
+
+    QAPI_LIST_PREPEND(list, 10 * SCALE_S);
+    QAPI_LIST_PREPEND(list, 1 * SCALE_S);
+    return list;
+}
+
+static void test_histogram(void)
+{
+    BlockAcctStats stats = {};
+    BlockLatencyHistogram *hist;
+    uint64List *boundaries = make_boundaries();
+
+    block_acct_init(&stats);
+    g_assert(block_latency_histogram_set(&stats, BLOCK_ACCT_READ,
+                                         boundaries) == 0);
+    g_assert_null(stats.latency_histogram[BLOCK_ACCT_WRITE]);
+
+    account_read(&stats, 512, 0, false);
+    account_read(&stats, 512, 2 * SCALE_S, false);
+    account_read(&stats, 512, 2 * SCALE_S, false);
+    account_read(&stats, 512, 20 * SCALE_S, true);
+
+    hist = stats.latency_histogram[BLOCK_ACCT_READ];
+    g_assert_cmpint(hist->nbins, ==, 3);
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 0), ==, 1);
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 1), ==, 2);
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 2), ==, 1);
+
+    block_latency_histograms_clear(&stats);
+    g_assert_null(stats.latency_histogram[BLOCK_ACCT_READ]);
+    account_read(&stats, 512, 0, false);
+
+    qapi_free_uint64List(boundaries);
+    block_acct_cleanup(&stats);
+}
+
+static void *account_thread(void *opaque)
+{
+    BlockAcctStats *stats = opaque;
+    int i;
+
+    for (i = 0; i < NR_REQUESTS; i++) {
+        account_read(stats, 512, i % 2 ? 2 * SCALE_S : 0, false);
+    }
+    return NULL;
+}
+
+/* More threads than shards, so that some of them share one */
+static void test_threads(void)
+{
+    BlockAcctStats stats = {};
+    BlockAcctCounters counters;
+    BlockLatencyHistogram *hist;
+    QemuThread threads[NR_THREADS];
+    uint64List *boundaries = make_boundaries();
+    int i;
+
+    block_acct_init(&stats);
+    block_latency_histogram_set(&stats, BLOCK_ACCT_READ, boundaries);
+
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_create(&threads[i], "acct", account_thread, &stats,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < NR_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    block_acct_get_counters(&stats, &counters);
+    g_assert_cmpuint(counters.nr_ops[BLOCK_ACCT_READ], ==,
+                     NR_THREADS * NR_REQUESTS);
+    g_assert_cmpuint(counters.nr_bytes[BLOCK_ACCT_READ], ==,
+                     NR_THREADS * NR_REQUESTS * 512ULL);
+
+    hist = stats.latency_histogram[BLOCK_ACCT_READ];
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 0), ==,
+                     NR_THREADS * NR_REQUESTS / 2);
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 1), ==,
+                     NR_THREADS * NR_REQUESTS / 2);
+    g_assert_cmpuint(block_latency_histogram_bin(hist, 2), ==, 0);
+
+    qapi_free_uint64List(boundaries);
+    block_acct_cleanup(&stats);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/block-accounting/counters", test_counters);
+    g_test_add_func("/block-accounting/histogram", test_histogram);
+    g_test_add_func("/block-accounting/threads", test_threads);
+
+    return g_test_run();
+}
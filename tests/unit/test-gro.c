@@ -0,0 +1,266 @@
+/*
+ * Test the generic receive offload engine
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+
+#define MSS         100
+#define HDR_LEN     (ETH_HLEN + sizeof(struct ip_header) + \
+                     sizeof(struct tcp_header))
+#define SEQ         1000
+
+typedef struct TestFrame {
+    bool gso;
+    struct virtio_net_hdr hdr;
+    uint8_t buf[HDR_LEN + 16 * MSS];
+    size_t size;
+} TestFrame;
+
+typedef struct TestGRO {
+    NetGRO *gro;
+    bool fail;
+    unsigned int nb_frames;
+    TestFrame frames[8];
+} TestGRO;
+
+static ssize_t test_deliver(void *opaque, const struct virtio_net_hdr *hdr,
+                            const uint8_t *buf, size_t size)
+{
+    TestGRO *t = opaque;
+    TestFrame *f;
+
+    if (t->fail) {
+        return 0;
+    }
+
+    g_assert_cmpuint(t->nb_frames, <, ARRAY_SIZE(t->frames));
+    g_assert_cmpuint(size, <=, sizeof(f->buf));
+    f = &t->frames[t->nb_frames++];
+    f->gso = hdr != NULL;
+    if (hdr) {
+        f->hdr = *hdr;
+    }
+    memcpy(f->buf, buf, size);
+    f->size = size;
+    return size;
+}
+
+static void test_gro_init(TestGRO *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->gro = net_gro_new(test_deliver, t);
+    net_gro_set_offloads(t->gro, true, false);
+}
+
+/*
+ * Build an IPv4 TCP segment with @len bytes of payload, whose bytes are
+ * the low bits of their sequence number, with valid checksums.
+ */
+static size_t make_segment(uint8_t *buf, uint32_t seq, size_t len,
+                           uint8_t flags)
+{
+    struct eth_header *eth = (struct eth_header *)buf;
+    struct ip_header *ip = (struct ip_header *)(buf + ETH_HLEN);
+    struct tcp_header *tcp = (struct tcp_header *)(ip + 1);
+    uint8_t *payload = (uint8_t *)(tcp + 1);
+    size_t l4_len = sizeof(*tcp) + len;
+    uint32_t sum;
+    size_t i;
+
+    memset(buf, 0, HDR_LEN);
+    memset(eth->h_dest, 0x52, ETH_ALEN);
+    memset(eth->h_source, 0x54, ETH_ALEN);
+    stw_be_p(&eth->h_proto, ETH_P_IP);
+
+    ip->ip_ver_len = 0x45;
+    stw_be_p(&ip->ip_len, sizeof(*ip) + l4_len);
+    ip->ip_ttl = 64;
+    ip->ip_p = IP_PROTO_TCP;
+    stl_be_p(&ip->ip_src, 0x0a000001);
+    stl_be_p(&ip->ip_dst, 0x0a000002);
+    stw_be_p(&ip->ip_sum, net_raw_checksum((uint8_t *)ip, sizeof(*ip)));
+
+    stw_be_p(&tcp->th_sport, 12345);
+    stw_be_p(&tcp->th_dport, 80);
+    stl_be_p(&tcp->th_seq, seq);
+    stl_be_p(&tcp->th_ack, 1);
+    stw_be_p(&tcp->th_offset_flags, (sizeof(*tcp) / 4) << 12 | flags);
+    stw_be_p(&tcp->th_win, 65535);
+    for (i = 0; i < len; i++) {
+        payload[i] = seq + i;
+    }
+
+    sum = net_checksum_add(8, (uint8_t *)&ip->ip_src);
+    sum += IP_PROTO_TCP + l4_len;
+    sum += net_checksum_add(l4_len, (uint8_t *)tcp);
+    stw_be_p(&tcp->th_sum, net_checksum_finish(sum));
+
+    return HDR_LEN + len;
+}
+
+static ssize_t receive_segment(TestGRO *t, uint32_t seq, size_t len,
+                               uint8_t flags)
+{
+    uint8_t buf[HDR_LEN + MSS];
+    size_t size = make_segment(buf, seq, len, flags);
+
+    return net_gro_receive(t->gro, buf, size);
+}
+
+/* Check that @f carries the payload from @seq to @seq + @len */
+static void check_frame(TestFrame *f, uint32_t seq, size_t len)
+{
+    const uint8_t *ip = f->buf + ETH_HLEN;
+    const uint8_t *tcp = ip + sizeof(struct ip_header);
+    size_t i;
+
+    g_assert_cmpuint(f->size, ==, HDR_LEN + len);
+    g_assert_cmpuint(lduw_be_p(ip + offsetof(struct ip_header, ip_len)), ==,
+                     f->size - ETH_HLEN);
+    g_assert_cmpuint(net_raw_checksum((uint8_t *)ip,
+                                      sizeof(struct ip_header)), ==, 0);
+    g_assert_cmpuint(ldl_be_p(tcp + offsetof(struct tcp_header, th_seq)), ==,
+                     seq);
+    for (i = 0; i < len; i++) {
+        g_assert_cmpuint(f->buf[HDR_LEN + i], ==, (uint8_t)(seq + i));
+    }
+
+    if (len > MSS) {
+        g_assert_true(f->gso);
+        g_assert_cmpuint(f->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_TCPV4);
+        g_assert_cmpuint(f->hdr.gso_size, ==, MSS);
+        g_assert_cmpuint(f->hdr.hdr_len, ==, HDR_LEN);
+        g_assert_cmpuint(f->hdr.flags, ==, VIRTIO_NET_HDR_F_DATA_VALID);
+    } else {
+        g_assert_false(f->gso);
+    }
+}
+
+static void test_gro_merge(void)
+{
+    TestGRO t;
+    int i;
+
+    test_gro_init(&t);
+    for (i = 0; i < 4; i++) {
+        g_assert_cmpint(receive_segment(&t, SEQ + i * MSS, MSS, TCP_FLAG_ACK),
+                        ==, HDR_LEN + MSS);
+    }
+    g_assert_cmpuint(t.nb_frames, ==, 0);
+    g_assert_true(net_gro_has_pending(t.gro));
+
+    g_assert_true(net_gro_flush(t.gro));
+    g_assert_false(net_gro_has_pending(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 1);
+    check_frame(&t.frames[0], SEQ, 4 * MSS);
+
+    net_gro_free(t.gro);
+}
+
+static void test_gro_psh(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+    receive_segment(&t, SEQ, MSS, TCP_FLAG_ACK);
+    receive_segment(&t, SEQ + MSS, MSS, TCP_FLAG_ACK | TH_PUSH);
+
+    /* PSH ends the frame without waiting for the end of the burst */
+    g_assert_false(net_gro_has_pending(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 1);
+    check_frame(&t.frames[0], SEQ, 2 * MSS);
+    g_assert_cmpuint(t.frames[0].buf[HDR_LEN - 7] & TH_PUSH, !=, 0);
+
+    net_gro_free(t.gro);
+}
+
+static void test_gro_short(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+    receive_segment(&t, SEQ, MSS, TCP_FLAG_ACK);
+    receive_segment(&t, SEQ + MSS, MSS, TCP_FLAG_ACK);
+    receive_segment(&t, SEQ + 2 * MSS, MSS / 2, TCP_FLAG_ACK);
+
+    g_assert_false(net_gro_has_pending(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 1);
+    check_frame(&t.frames[0], SEQ, 2 * MSS + MSS / 2);
+
+    net_gro_free(t.gro);
+}
+
+static void test_gro_out_of_order(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+    receive_segment(&t, SEQ, MSS, TCP_FLAG_ACK);
+    receive_segment(&t, SEQ + MSS, MSS, TCP_FLAG_ACK);
+
+    /* A gap sends the data held so far, and starts a new frame */
+    receive_segment(&t, SEQ + 3 * MSS, MSS, TCP_FLAG_ACK);
+    g_assert_cmpuint(t.nb_frames, ==, 1);
+    check_frame(&t.frames[0], SEQ, 2 * MSS);
+
+    /* A retransmission goes after the new frame */
+    receive_segment(&t, SEQ + 2 * MSS, MSS, TCP_FLAG_ACK);
+    g_assert_true(net_gro_flush(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 3);
+    check_frame(&t.frames[1], SEQ + 3 * MSS, MSS);
+    check_frame(&t.frames[2], SEQ + 2 * MSS, MSS);
+
+    net_gro_free(t.gro);
+}
+
+static void test_gro_deliver_fail(void)
+{
+    TestGRO t;
+
+    test_gro_init(&t);
+    t.fail = true;
+
+    /* The PSH segment is merged, even if the frame cannot go yet */
+    g_assert_cmpint(receive_segment(&t, SEQ, MSS, TCP_FLAG_ACK), >, 0);
+    g_assert_cmpint(receive_segment(&t, SEQ + MSS, MSS,
+                                    TCP_FLAG_ACK | TH_PUSH), >, 0);
+    g_assert_true(net_gro_has_pending(t.gro));
+
+    /* Nothing may be appended after the PSH, so the next one must wait */
+    g_assert_cmpint(receive_segment(&t, SEQ + 2 * MSS, MSS, TCP_FLAG_ACK),
+                    ==, 0);
+    g_assert_false(net_gro_flush(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 0);
+
+    t.fail = false;
+    g_assert_true(net_gro_flush(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 1);
+    check_frame(&t.frames[0], SEQ, 2 * MSS);
+
+    /* The retried segment starts a frame of its own */
+    g_assert_cmpint(receive_segment(&t, SEQ + 2 * MSS, MSS, TCP_FLAG_ACK),
+                    >, 0);
+    g_assert_true(net_gro_flush(t.gro));
+    g_assert_cmpuint(t.nb_frames, ==, 2);
+    check_frame(&t.frames[1], SEQ + 2 * MSS, MSS);
+
+    net_gro_free(t.gro);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gro/merge", test_gro_merge);
+    g_test_add_func("/net/gro/psh", test_gro_psh);
+    g_test_add_func("/net/gro/short", test_gro_short);
+    g_test_add_func("/net/gro/out-of-order", test_gro_out_of_order);
+    g_test_add_func("/net/gro/deliver-fail", test_gro_deliver_fail);
+
+    return g_test_run();
+}
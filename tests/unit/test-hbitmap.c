@@ -20,12 +20,16 @@
 #define L2                         (BITS_PER_LONG * L1)
 #define L3                         (BITS_PER_LONG * L2)
 
+/* Bits per chunk of the last level, with 32-bit and 64-bit longs alike */
+#define CHUNK                      (1 << 15)
+
 typedef struct TestHBitmapData {
     HBitmap       *hb;
     unsigned long *bits;
     size_t         size;
     size_t         old_size;
     int            granularity;
+    bool           sparse;
 } TestHBitmapData;
 
 
@@ -80,6 +84,9 @@ static void hbitmap_test_init(TestHBitmapData *data,
 {
     size_t n;
     data->hb = hbitmap_alloc(size, granularity);
+    if (data->sparse) {
+        hbitmap_set_sparse(data->hb, true);
+    }
 
     n = DIV_ROUND_UP(size, BITS_PER_LONG);
     if (n == 0) {
@@ -398,6 +405,90 @@ static void test_hbitmap_reset_all(TestHBitmapData *data,
     hbitmap_test_reset_all(data);
 }
 
+static void test_hbitmap_copy(TestHBitmapData *data,
+                              const void *unused)
+{
+    HBitmap *orig;
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L2, L3 - L2 + 1);
+    hbitmap_test_set(data, L3 * 2 - 3, 3);
+
+    /* The copy has the same contents... */
+    orig = data->hb;
+    data->hb = hbitmap_copy(orig);
+    hbitmap_test_check(data, 0);
+
+    /* ... and does not see later changes to the original.  */
+    hbitmap_reset_all(orig);
+    hbitmap_set(orig, 0, L3);
+    hbitmap_test_check(data, 0);
+    hbitmap_free(orig);
+}
+
+/* An iteration of a copy, as done by snapshot dirty bitmap iterators */
+static void test_hbitmap_copy_iter(TestHBitmapData *data,
+                                   const void *unused)
+{
+    HBitmap *copy;
+    HBitmapIter hbi;
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, 1, 1);
+    hbitmap_test_set(data, L2, 1);
+    hbitmap_test_set(data, L3 + 5, 1);
+
+    copy = hbitmap_copy(data->hb);
+    hbitmap_iter_init(&hbi, copy, 0);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), ==, 1);
+
+    /* Changing the original does not disturb the iteration */
+    hbitmap_test_reset(data, L2, 1);
+    hbitmap_test_set(data, 2, L3);
+    hbitmap_test_reset(data, L3 + 5, 1);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), ==, L2);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), ==, L3 + 5);
+    g_assert_cmpint(hbitmap_iter_next(&hbi), ==, -1);
+
+    hbitmap_free(copy);
+    hbitmap_test_check(data, 0);
+}
+
+static void test_hbitmap_sparse(TestHBitmapData *data,
+                                const void *unused)
+{
+    uint64_t i;
+
+    hbitmap_test_init(data, L3 * 2 + 5, 0);
+    hbitmap_set_sparse(data->hb, true);
+    g_assert(hbitmap_is_sparse(data->hb));
+
+    /* Whole chunks, then holes in them */
+    hbitmap_test_set(data, 0, L3 * 2 + 5);
+    hbitmap_test_reset(data, L1 - 1, L1 + 2);
+    hbitmap_test_reset(data, L2, L3 - L2 + 1);
+    hbitmap_test_set(data, L2 * 2, L2 * 3);
+    hbitmap_test_reset(data, 0, L3 * 2 + 5);
+
+    /* A chunk filled sequentially, then emptied */
+    for (i = 0; i < L3 / 4; i += L2) {
+        hbitmap_test_set(data, L3 + i, L2);
+    }
+    for (i = 0; i < L3 / 4; i += L2 * 3) {
+        hbitmap_test_reset(data, L3 + i, L2 * 3);
+    }
+
+    /* Switching back and forth keeps the contents */
+    hbitmap_test_set(data, L1 * 3, L3);
+    hbitmap_set_sparse(data->hb, false);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_reset(data, L2 + 7, L2);
+    hbitmap_set_sparse(data->hb, true);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_check(data, L2);
+}
+
 static void test_hbitmap_granularity(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -800,6 +891,32 @@ static void hbitmap_test_add(const char *testpath,
                hbitmap_test_teardown);
 }
 
+static void hbitmap_test_setup_sparse(TestHBitmapData *data,
+                                      const void *unused)
+{
+    data->sparse = true;
+}
+
+/* Run a test against a sparse bitmap, under /hbitmap/sparse/ */
+static void hbitmap_test_add_sparse(const char *testpath,
+                                    void (*test_func)(TestHBitmapData *data,
+                                                      const void *user_data))
+{
+    g_autofree char *path = g_strdup_printf("/hbitmap/sparse%s",
+                                            testpath + strlen("/hbitmap"));
+
+    g_test_add(path, TestHBitmapData, NULL, hbitmap_test_setup_sparse,
+               test_func, hbitmap_test_teardown);
+}
+
+static void hbitmap_test_add_both(const char *testpath,
+                                  void (*test_func)(TestHBitmapData *data,
+                                                    const void *user_data))
+{
+    hbitmap_test_add(testpath, test_func);
+    hbitmap_test_add_sparse(testpath, test_func);
+}
+
 static void test_hbitmap_iter_and_reset(TestHBitmapData *data,
                                         const void *unused)
 {
@@ -1042,76 +1159,160 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/*
+ * Operations on and across the boundaries of last-level chunks.  In a
+ * sparse bitmap, a chunk with all bits set shares the read-only ones
+ * chunk, and must be copied before bits in it are cleared again.
+ */
+static void test_hbitmap_chunks(TestHBitmapData *data, const void *unused)
+{
+    int64_t starts[] = { 0, CHUNK - 1, CHUNK, CHUNK + 1, CHUNK * 2 - 1,
+                         CHUNK * 2, CHUNK * 3 - 1, CHUNK * 3 };
+    size_t buf_size;
+    uint8_t *buf;
+    HBitmap *orig;
+    int i;
+
+    hbitmap_test_init(data, CHUNK * 3 + 5, 0);
+
+    /* A whole chunk, then the bits around it */
+    hbitmap_test_set(data, CHUNK, CHUNK);
+    hbitmap_test_set(data, CHUNK - 3, 3);
+    hbitmap_test_set(data, CHUNK * 2, 2);
+
+    /* The partial chunk at the end */
+    hbitmap_test_set(data, CHUNK * 3, 5);
+
+    for (i = 0; i < ARRAY_SIZE(starts); i++) {
+        test_hbitmap_next_x_check(data, starts[i]);
+        test_hbitmap_next_x_check_range(data, starts[i], CHUNK);
+        test_hbitmap_next_dirty_area_check(data, starts[i], INT64_MAX);
+        test_hbitmap_next_dirty_area_check_limited(data, starts[i],
+                                                   INT64_MAX, CHUNK / 2);
+        hbitmap_test_check(data, starts[i]);
+    }
+
+    /* Holes in the full chunk, at its ends and across its boundaries */
+    hbitmap_test_reset(data, CHUNK + L1 * 3, L1 + 7);
+    hbitmap_test_reset(data, CHUNK * 2 - 1, 2);
+    hbitmap_test_set(data, CHUNK, CHUNK);
+    hbitmap_test_reset(data, CHUNK - 1, 2);
+    hbitmap_test_set(data, CHUNK - 1, CHUNK * 2 + 6);
+    for (i = 0; i < ARRAY_SIZE(starts); i++) {
+        test_hbitmap_next_x_check(data, starts[i]);
+        test_hbitmap_next_dirty_area_check(data, starts[i], INT64_MAX);
+    }
+
+    /* A copy does not share the writable chunks of the original */
+    orig = data->hb;
+    data->hb = hbitmap_copy(orig);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_reset(data, CHUNK + 5, 1);
+    g_assert(hbitmap_get(orig, CHUNK + 5));
+    hbitmap_free(orig);
+
+    /* Serialize and deserialize across the chunks */
+    buf_size = hbitmap_serialization_size(data->hb, 0, data->size);
+    buf = g_malloc0(buf_size);
+    hbitmap_serialize_part(data->hb, buf, 0, data->size);
+    hbitmap_reset_all(data->hb);
+    hbitmap_deserialize_part(data->hb, buf, 0, data->size, true);
+    hbitmap_test_check(data, 0);
+    g_free(buf);
+
+    /* Shrink into the middle of a full chunk, then grow back */
+    hbitmap_test_truncate_impl(data, CHUNK + L1 + 1);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_truncate_impl(data, CHUNK * 3 + 5);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_set(data, CHUNK + L1, CHUNK * 2);
+    hbitmap_test_truncate_impl(data, CHUNK * 2);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_truncate_impl(data, CHUNK * 4);
+    hbitmap_test_check(data, 0);
+    test_hbitmap_next_x_check(data, CHUNK * 2 - 1);
+    test_hbitmap_next_dirty_area_check(data, CHUNK, INT64_MAX);
+
+    hbitmap_test_reset_all(data);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     hbitmap_test_add("/hbitmap/size/0", test_hbitmap_zero);
     hbitmap_test_add("/hbitmap/size/unaligned", test_hbitmap_unaligned);
-    hbitmap_test_add("/hbitmap/iter/empty", test_hbitmap_iter_empty);
-    hbitmap_test_add("/hbitmap/iter/partial", test_hbitmap_iter_partial);
-    hbitmap_test_add("/hbitmap/iter/granularity", test_hbitmap_iter_granularity);
+    hbitmap_test_add_both("/hbitmap/iter/empty", test_hbitmap_iter_empty);
+    hbitmap_test_add_both("/hbitmap/iter/partial",
+                          test_hbitmap_iter_partial);
+    hbitmap_test_add_both("/hbitmap/iter/granularity",
+                          test_hbitmap_iter_granularity);
     hbitmap_test_add("/hbitmap/get/all", test_hbitmap_get_all);
     hbitmap_test_add("/hbitmap/get/some", test_hbitmap_get_some);
     hbitmap_test_add("/hbitmap/set/all", test_hbitmap_set_all);
     hbitmap_test_add("/hbitmap/set/one", test_hbitmap_set_one);
     hbitmap_test_add("/hbitmap/set/two-elem", test_hbitmap_set_two_elem);
-    hbitmap_test_add("/hbitmap/set/general", test_hbitmap_set);
+    hbitmap_test_add_both("/hbitmap/set/general", test_hbitmap_set);
     hbitmap_test_add("/hbitmap/set/twice", test_hbitmap_set_twice);
-    hbitmap_test_add("/hbitmap/set/overlap", test_hbitmap_set_overlap);
+    hbitmap_test_add_both("/hbitmap/set/overlap", test_hbitmap_set_overlap);
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
-    hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
-    hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
+    hbitmap_test_add_both("/hbitmap/reset/general", test_hbitmap_reset);
+    hbitmap_test_add_both("/hbitmap/reset/all", test_hbitmap_reset_all);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
-
-    hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
-    hbitmap_test_add("/hbitmap/truncate/grow/negligible",
-                     test_hbitmap_truncate_grow_negligible);
-    hbitmap_test_add("/hbitmap/truncate/shrink/negligible",
-                     test_hbitmap_truncate_shrink_negligible);
-    hbitmap_test_add("/hbitmap/truncate/grow/tiny",
-                     test_hbitmap_truncate_grow_tiny);
-    hbitmap_test_add("/hbitmap/truncate/shrink/tiny",
-                     test_hbitmap_truncate_shrink_tiny);
-    hbitmap_test_add("/hbitmap/truncate/grow/small",
-                     test_hbitmap_truncate_grow_small);
-    hbitmap_test_add("/hbitmap/truncate/shrink/small",
-                     test_hbitmap_truncate_shrink_small);
-    hbitmap_test_add("/hbitmap/truncate/grow/medium",
-                     test_hbitmap_truncate_grow_medium);
-    hbitmap_test_add("/hbitmap/truncate/shrink/medium",
-                     test_hbitmap_truncate_shrink_medium);
-    hbitmap_test_add("/hbitmap/truncate/grow/large",
-                     test_hbitmap_truncate_grow_large);
-    hbitmap_test_add("/hbitmap/truncate/shrink/large",
-                     test_hbitmap_truncate_shrink_large);
+    hbitmap_test_add_both("/hbitmap/copy", test_hbitmap_copy);
+    hbitmap_test_add_both("/hbitmap/copy/iter", test_hbitmap_copy_iter);
+    hbitmap_test_add("/hbitmap/sparse", test_hbitmap_sparse);
+
+    hbitmap_test_add_both("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
+    hbitmap_test_add_both("/hbitmap/truncate/grow/negligible",
+                          test_hbitmap_truncate_grow_negligible);
+    hbitmap_test_add_both("/hbitmap/truncate/shrink/negligible",
+                          test_hbitmap_truncate_shrink_negligible);
+    hbitmap_test_add_both("/hbitmap/truncate/grow/tiny",
+                          test_hbitmap_truncate_grow_tiny);
+    hbitmap_test_add_both("/hbitmap/truncate/shrink/tiny",
+                          test_hbitmap_truncate_shrink_tiny);
+    hbitmap_test_add_both("/hbitmap/truncate/grow/small",
+                          test_hbitmap_truncate_grow_small);
+    hbitmap_test_add_both("/hbitmap/truncate/shrink/small",
+                          test_hbitmap_truncate_shrink_small);
+    hbitmap_test_add_both("/hbitmap/truncate/grow/medium",
+                          test_hbitmap_truncate_grow_medium);
+    hbitmap_test_add_both("/hbitmap/truncate/shrink/medium",
+                          test_hbitmap_truncate_shrink_medium);
+    hbitmap_test_add_both("/hbitmap/truncate/grow/large",
+                          test_hbitmap_truncate_grow_large);
+    hbitmap_test_add_both("/hbitmap/truncate/shrink/large",
+                          test_hbitmap_truncate_shrink_large);
 
     hbitmap_test_add("/hbitmap/serialize/align",
                      test_hbitmap_serialize_align);
-    hbitmap_test_add("/hbitmap/serialize/basic",
-                     test_hbitmap_serialize_basic);
-    hbitmap_test_add("/hbitmap/serialize/part",
-                     test_hbitmap_serialize_part);
-    hbitmap_test_add("/hbitmap/serialize/zeroes",
-                     test_hbitmap_serialize_zeroes);
-
-    hbitmap_test_add("/hbitmap/iter/iter_and_reset",
-                     test_hbitmap_iter_and_reset);
-
-    hbitmap_test_add("/hbitmap/next_zero/next_x_0",
-                     test_hbitmap_next_x_0);
-    hbitmap_test_add("/hbitmap/next_zero/next_x_4",
-                     test_hbitmap_next_x_4);
-    hbitmap_test_add("/hbitmap/next_zero/next_x_after_truncate",
-                     test_hbitmap_next_x_after_truncate);
-
-    hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_0",
-                     test_hbitmap_next_dirty_area_0);
-    hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_1",
-                     test_hbitmap_next_dirty_area_1);
-    hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_4",
-                     test_hbitmap_next_dirty_area_4);
-    hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
-                     test_hbitmap_next_dirty_area_after_truncate);
+    hbitmap_test_add_both("/hbitmap/serialize/basic",
+                          test_hbitmap_serialize_basic);
+    hbitmap_test_add_both("/hbitmap/serialize/part",
+                          test_hbitmap_serialize_part);
+    hbitmap_test_add_both("/hbitmap/serialize/zeroes",
+                          test_hbitmap_serialize_zeroes);
+
+    hbitmap_test_add_both("/hbitmap/iter/iter_and_reset",
+                          test_hbitmap_iter_and_reset);
+
+    hbitmap_test_add_both("/hbitmap/next_zero/next_x_0",
+                          test_hbitmap_next_x_0);
+    hbitmap_test_add_both("/hbitmap/next_zero/next_x_4",
+                          test_hbitmap_next_x_4);
+    hbitmap_test_add_both("/hbitmap/next_zero/next_x_after_truncate",
+                          test_hbitmap_next_x_after_truncate);
+
+    hbitmap_test_add_both("/hbitmap/next_dirty_area/next_dirty_area_0",
+                          test_hbitmap_next_dirty_area_0);
+    hbitmap_test_add_both("/hbitmap/next_dirty_area/next_dirty_area_1",
+                          test_hbitmap_next_dirty_area_1);
+    hbitmap_test_add_both("/hbitmap/next_dirty_area/next_dirty_area_4",
+                          test_hbitmap_next_dirty_area_4);
+    hbitmap_test_add_both("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
+                          test_hbitmap_next_dirty_area_after_truncate);
+
+    hbitmap_test_add_both("/hbitmap/chunks", test_hbitmap_chunks);
 
     g_test_run();
 
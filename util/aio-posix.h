@@ -38,6 +38,7 @@ struct AioHandler {
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
+    bool is_event_notifier; /* fd is an EventNotifier, cleared by io_read */
 };
 
 /* Add a handler to a ready list */
@@ -25,7 +25,10 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  EventNotifiers
+ *    use multishot poll, which stays armed and produces a cqe for each event.
+ *    Other file descriptors use one-shot poll, which is re-armed after each
+ *    event.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -48,6 +51,11 @@
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+/* Cleared when the kernel turns out not to support multishot poll */
+static bool multishot_poll = true;
+#endif
+
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
@@ -171,6 +179,20 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     struct io_uring_sqe *sqe = get_sqe(ctx);
     int events = poll_events_from_pfd(node->pfd.events);
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    /*
+     * Multishot poll reports wakeups rather than the current state of the
+     * file descriptor, so an event that the handler leaves pending is not
+     * reported again.  That is fine for EventNotifiers, whose handlers clear
+     * them, and saves re-arming the poll (and thus a syscall) per event.
+     */
+    if (node->is_event_notifier && qatomic_read(&multishot_poll)) {
+        io_uring_prep_poll_multishot(sqe, node->pfd.fd, events);
+        io_uring_sqe_set_data(sqe, node);
+        return;
+    }
+#endif
+
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
     io_uring_sqe_set_data(sqe, node);
 }
@@ -234,6 +256,18 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        /* Multishot poll is still armed, the handler cannot be freed yet */
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+        aio_add_ready_handler(ready_list, node,
+                              pfd_events_from_poll(cqe->res));
+        return true;
+    }
+#endif
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -245,9 +279,22 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (cqe->res == -EINVAL && node->is_event_notifier &&
+        qatomic_read(&multishot_poll)) {
+        /* Kernels older than 5.13 reject multishot poll */
+        qatomic_set(&multishot_poll, false);
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+#endif
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /*
+     * IORING_OP_POLL_ADD is one-shot, and multishot poll can terminate too,
+     * e.g. when the cq ring overflows, so we must re-arm it
+     */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -14,6 +14,7 @@
 #include "qemu/host-utils.h"
 #include "trace.h"
 #include "crypto/hash.h"
+#include "host/cpuinfo.h"
 
 /* HBitmaps provides an array of bits.  The bits are stored as usual in an
  * array of unsigned longs, but HBitmap is also optimized to provide fast
@@ -50,6 +51,14 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level, which takes the bulk of the memory, is split in chunks of
+ * 4 KiB that are only allocated when a bit in them is first set.  A bitmap
+ * can also be made sparse with hbitmap_set_sparse(); a sparse bitmap frees
+ * chunks again when they have no bit set, and shares a single read-only
+ * chunk among those that have all bits set.  A mostly clean (or mostly
+ * dirty) bitmap for a large disk then costs little more than its upper
+ * levels, i.e. about 1/64 of the flat representation.
  */
 
 struct HBitmap {
@@ -93,14 +102,305 @@ struct HBitmap {
      * actual bitmap.
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
-     * bitmap will still allocate HBITMAP_LEVELS arrays.
+     * bitmap will still allocate HBITMAP_LEVELS arrays.  The last level is
+     * not stored here, but in chunks[].
      */
     unsigned long *levels[HBITMAP_LEVELS];
 
-    /* The length of each levels[] array. */
+    /* The length of each levels[] array, in words. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /* The last level, HB_CHUNK_WORDS words per chunk.  NULL stands for a
+     * chunk with no bits set; in a sparse bitmap, HB_ONES stands for a chunk
+     * with all bits set.
+     */
+    unsigned long **chunks;
+    size_t nr_chunks;
+    bool sparse;
+};
+
+#define HB_CHUNK_SHIFT         (BITS_PER_LONG == 32 ? 10 : 9)
+#define HB_CHUNK_WORDS         (1 << HB_CHUNK_SHIFT)
+#define HB_CHUNK_BITS_SHIFT    (HB_CHUNK_SHIFT + BITS_PER_LEVEL)
+#define HB_CHUNK_BITS          ((uint64_t)1 << HB_CHUNK_BITS_SHIFT)
+
+static const unsigned long hb_zero_chunk[HB_CHUNK_WORDS];
+static const unsigned long hb_ones_chunk[HB_CHUNK_WORDS] = {
+    [0 ... HB_CHUNK_WORDS - 1] = ~0UL
 };
 
+#define HB_ONES                ((unsigned long *)hb_ones_chunk)
+
+/* Return word pos of the last level.  */
+static inline unsigned long hb_last_word(const HBitmap *hb, size_t pos)
+{
+    const unsigned long *chunk = hb->chunks[pos >> HB_CHUNK_SHIFT];
+
+    return chunk ? chunk[pos & (HB_CHUNK_WORDS - 1)] : 0;
+}
+
+/* Return word pos of the given level.  */
+static inline unsigned long hb_word(const HBitmap *hb, int level, size_t pos)
+{
+    if (level == HBITMAP_LEVELS - 1) {
+        return hb_last_word(hb, pos);
+    }
+    return hb->levels[level][pos];
+}
+
+/* Bulk operations on runs of words.  Dense bitmaps spend most of their time
+ * here, so they are vectorized where the host allows it.
+ */
+
+/* Return the index of the first word in [pos, end) that is equal to val
+ * if equal is true, or different from val if equal is false.  Return end
+ * if there is none.
+ */
+static size_t hb_find_word_int(const unsigned long *p, size_t pos, size_t end,
+                               unsigned long val, bool equal)
+{
+    while (pos < end && (p[pos] == val) != equal) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Return the number of bits set in the first n words of p. */
+static uint64_t hb_popcount_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+#if defined(CONFIG_AVX2_OPT)
+#include <immintrin.h>
+
+#define HB_WORDS_PER_VEC   (sizeof(__m256i) / sizeof(unsigned long))
+
+static size_t __attribute__((target("avx2")))
+hb_find_word_avx2(const unsigned long *p, size_t pos, size_t end,
+                  unsigned long val, bool equal)
+{
+#if BITS_PER_LONG == 64
+    __m256i v = _mm256_set1_epi64x(val);
+#else
+    __m256i v = _mm256_set1_epi32(val);
+#endif
+    uint32_t stop = equal ? 0 : UINT32_MAX;
+
+    for (; pos + 2 * HB_WORDS_PER_VEC <= end; pos += 2 * HB_WORDS_PER_VEC) {
+        __m256i w0 = _mm256_loadu_si256((const __m256i *)&p[pos]);
+        __m256i w1 = _mm256_loadu_si256((const __m256i *)
+                                        &p[pos + HB_WORDS_PER_VEC]);
+        uint32_t m0, m1;
+
+#if BITS_PER_LONG == 64
+        m0 = _mm256_movemask_epi8(_mm256_cmpeq_epi64(w0, v));
+        m1 = _mm256_movemask_epi8(_mm256_cmpeq_epi64(w1, v));
+#else
+        m0 = _mm256_movemask_epi8(_mm256_cmpeq_epi32(w0, v));
+        m1 = _mm256_movemask_epi8(_mm256_cmpeq_epi32(w1, v));
+#endif
+        if (m0 != stop || m1 != stop) {
+            break;
+        }
+    }
+    return hb_find_word_int(p, pos, end, val, equal);
+}
+
+static uint64_t __attribute__((target("avx2")))
+hb_popcount_avx2(const unsigned long *p, size_t n)
+{
+    /* Per-nibble population count, looked up with vpshufb */
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_VEC <= n; i += HB_WORDS_PER_VEC) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)&p[i]);
+        __m256i lo = _mm256_and_si256(w, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(w, 4), low_mask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+
+        /* Sum the byte counts into four 64-bit accumulators */
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt,
+                                                    _mm256_setzero_si256()));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           hb_popcount_int(&p[i], n - i);
+}
+
+static size_t (*hb_find_word)(const unsigned long *, size_t, size_t,
+                              unsigned long, bool) = hb_find_word_int;
+static uint64_t (*hb_popcount)(const unsigned long *, size_t) =
+    hb_popcount_int;
+
+static void __attribute__((constructor)) hb_init_accel(void)
+{
+    if (cpuinfo_init() & CPUINFO_AVX2) {
+        hb_find_word = hb_find_word_avx2;
+        hb_popcount = hb_popcount_avx2;
+    }
+}
+
+#elif defined(__aarch64__) && HOST_LONG_BITS == 64
+#include <arm_neon.h>
+
+static size_t hb_find_word_neon(const unsigned long *p, size_t pos,
+                                size_t end, unsigned long val, bool equal)
+{
+    uint64x2_t v = vdupq_n_u64(val);
+
+    for (; pos + 4 <= end; pos += 4) {
+        uint64x2_t m0 = vceqq_u64(vld1q_u64((const uint64_t *)&p[pos]), v);
+        uint64x2_t m1 = vceqq_u64(vld1q_u64((const uint64_t *)&p[pos + 2]),
+                                  v);
+        uint32x4_t m = vreinterpretq_u32_u64(equal ? vorrq_u64(m0, m1)
+                                                   : vandq_u64(m0, m1));
+
+        if (equal ? vmaxvq_u32(m) != 0 : vminvq_u32(m) != UINT32_MAX) {
+            break;
+        }
+    }
+    return hb_find_word_int(p, pos, end, val, equal);
+}
+
+static uint64_t hb_popcount_neon(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        uint8x16_t w = vreinterpretq_u8_u64(vld1q_u64((const uint64_t *)&p[i]));
+        count += vaddlvq_u8(vcntq_u8(w));
+    }
+    return count + hb_popcount_int(&p[i], n - i);
+}
+
+#define hb_find_word   hb_find_word_neon
+#define hb_popcount    hb_popcount_neon
+
+#else
+#define hb_find_word   hb_find_word_int
+#define hb_popcount    hb_popcount_int
+#endif
+
+/* Return chunk c of hb, allocating it if it is not backed by memory of
+ * its own.
+ */
+static unsigned long *hb_chunk_writable(HBitmap *hb, size_t c)
+{
+    unsigned long *chunk = hb->chunks[c];
+
+    if (!chunk) {
+        chunk = g_new0(unsigned long, HB_CHUNK_WORDS);
+    } else if (chunk == HB_ONES) {
+        chunk = g_new(unsigned long, HB_CHUNK_WORDS);
+        memset(chunk, 0xff, HB_CHUNK_WORDS * sizeof(unsigned long));
+    } else {
+        return chunk;
+    }
+    hb->chunks[c] = chunk;
+    return chunk;
+}
+
+/* Set all bits of chunk c to zero or one.  */
+static void hb_chunk_fill(HBitmap *hb, size_t c, bool ones)
+{
+    if (hb->sparse) {
+        if (hb->chunks[c] != HB_ONES) {
+            g_free(hb->chunks[c]);
+        }
+        hb->chunks[c] = ones ? HB_ONES : NULL;
+    } else if (ones || hb->chunks[c]) {
+        memset(hb_chunk_writable(hb, c), ones ? 0xff : 0,
+               HB_CHUNK_WORDS * sizeof(unsigned long));
+    }
+}
+
+/* In a sparse bitmap, release the memory of chunk c if it has no bit set,
+ * or if it lies entirely within the bitmap and has all bits set.
+ */
+static void hb_chunk_compact(HBitmap *hb, size_t c)
+{
+    unsigned long *chunk = hb->chunks[c];
+
+    if (!hb->sparse || !chunk || chunk == HB_ONES) {
+        return;
+    }
+    if (hb_find_word(chunk, 0, HB_CHUNK_WORDS, 0, false) == HB_CHUNK_WORDS) {
+        hb_chunk_fill(hb, c, false);
+    } else if (((uint64_t)(c + 1) << HB_CHUNK_BITS_SHIFT) <= hb->size &&
+               hb_find_word(chunk, 0, HB_CHUNK_WORDS, ~0UL, false) ==
+               HB_CHUNK_WORDS) {
+        hb_chunk_fill(hb, c, true);
+    }
+}
+
+/* Return the index of the first word in [pos, end) of the last level that
+ * is not all ones, or end if there is none.
+ */
+static size_t hb_last_find_not_ones(const HBitmap *hb, size_t pos, size_t end)
+{
+    while (pos < end) {
+        size_t c = pos >> HB_CHUNK_SHIFT;
+        size_t base = (size_t)c << HB_CHUNK_SHIFT;
+        size_t chunk_end = MIN(end - base, HB_CHUNK_WORDS);
+        const unsigned long *chunk = hb->chunks[c];
+
+        if (!chunk) {
+            return pos;
+        }
+        if (chunk != HB_ONES) {
+            size_t i = hb_find_word(chunk, pos - base, chunk_end, ~0UL, false);
+            if (i < chunk_end) {
+                return base + i;
+            }
+        }
+        pos = base + chunk_end;
+    }
+    return end;
+}
+
+/* Count the number of set bits in the last level, not accounting for the
+ * granularity.
+ */
+static uint64_t hb_count_all(const HBitmap *hb)
+{
+    size_t n = hb->size >> BITS_PER_LEVEL;
+    unsigned bit = hb->size & (BITS_PER_LONG - 1);
+    uint64_t count = 0;
+    size_t c;
+
+    for (c = 0; c < hb->nr_chunks; c++) {
+        size_t base = (size_t)c << HB_CHUNK_SHIFT;
+        size_t words = MIN(n - MIN(n, base), HB_CHUNK_WORDS);
+
+        if (hb->chunks[c] == HB_ONES) {
+            count += (uint64_t)words << BITS_PER_LEVEL;
+        } else if (hb->chunks[c]) {
+            count += hb_popcount(hb->chunks[c], words);
+        }
+    }
+    if (bit) {
+        count += ctpopl(hb_last_word(hb, n) & ((1UL << bit) - 1));
+    }
+    return count;
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -136,7 +436,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -149,7 +449,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_last_word(hbi->hb, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -182,7 +482,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -220,8 +520,7 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur;
     unsigned start_bit_offset;
     uint64_t end_bit, sz;
     int64_t res;
@@ -240,20 +539,18 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     /* There may be some zero bits in @cur before @start. We are not interested
      * in them, let's set them.
      */
+    cur = hb_last_word(hb, pos);
     start_bit_offset = (start >> hb->granularity) & (BITS_PER_LONG - 1);
     cur |= (1UL << start_bit_offset) - 1;
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_last_find_not_ones(hb, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
 
-        cur = last_lev[pos];
+        cur = hb_last_word(hb, pos);
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -426,37 +723,82 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     return old != *elem;
 }
 
-/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
-static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
-                           uint64_t last)
+/* Set bits start..last of the word array elems.  Returns true if at least
+ * one bit is changed.
+ */
+static bool hb_set_words(unsigned long *elems, uint64_t start, uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
-    size_t i;
 
-    i = pos;
-    if (i < lastpos) {
-        uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+    if (pos < lastpos) {
+        changed |= hb_set_elem(&elems[pos], start, start | (BITS_PER_LONG - 1));
+
+        /* The words in between are filled entirely; the layer above only
+         * changes if one of them was empty.
+         */
+        if (hb_find_word(elems, pos + 1, lastpos, 0, true) < lastpos) {
+            changed = true;
         }
+        memset(&elems[pos + 1], 0xff, (lastpos - pos - 1) * sizeof(*elems));
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(&elems[lastpos], start, last);
+    return changed;
+}
+
+/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
+ * Returns true if at least one bit is changed. */
+static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
+                           uint64_t last)
+{
+    bool changed = hb_set_words(hb->levels[level], start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
      */
     if (level > 0 && changed) {
-        hb_set_between(hb, level - 1, pos, lastpos);
+        hb_set_between(hb, level - 1, start >> BITS_PER_LEVEL,
+                       last >> BITS_PER_LEVEL);
+    }
+    return changed;
+}
+
+/* Same as hb_set_between, for the last layer.  */
+static bool hb_set_last(HBitmap *hb, uint64_t start, uint64_t last)
+{
+    size_t c = start >> HB_CHUNK_BITS_SHIFT;
+    size_t lastc = last >> HB_CHUNK_BITS_SHIFT;
+    bool changed = false;
+
+    for (; c <= lastc; c++) {
+        uint64_t base = (uint64_t)c << HB_CHUNK_BITS_SHIFT;
+        uint64_t first_bit = MAX(start, base) - base;
+        uint64_t last_bit = MIN(last - base, HB_CHUNK_BITS - 1);
+        unsigned long *chunk = hb->chunks[c];
+
+        if (chunk == HB_ONES) {
+            continue;
+        }
+        if (hb->sparse && first_bit == 0 && last_bit == HB_CHUNK_BITS - 1) {
+            changed |= !chunk ||
+                hb_find_word(chunk, 0, HB_CHUNK_WORDS, 0, true) <
+                    HB_CHUNK_WORDS;
+            hb_chunk_fill(hb, c, true);
+            continue;
+        }
+
+        changed |= hb_set_words(hb_chunk_writable(hb, c), first_bit, last_bit);
+        if (last_bit == HB_CHUNK_BITS - 1) {
+            /* Sequential writes fill chunks from start to end */
+            hb_chunk_compact(hb, c);
+        }
+    }
+
+    if (changed) {
+        hb_set_between(hb, HBITMAP_LEVELS - 2, start >> BITS_PER_LEVEL,
+                       last >> BITS_PER_LEVEL);
     }
     return changed;
 }
@@ -480,8 +822,7 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     n = last - first + 1;
 
     hb->count += n - hb_count_between(hb, first, last);
-    if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
+    if (hb_set_last(hb, first, last) && hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
 }
@@ -504,55 +845,103 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     return blanked;
 }
 
-/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
-static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
-                             uint64_t last)
+/* Clear bits start..last of the word array elems.  Returns true if at least
+ * one word became zero.
+ */
+static bool hb_reset_words(unsigned long *elems, uint64_t start, uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
-    size_t i;
 
-    i = pos;
-    if (i < lastpos) {
-        uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
+    if (pos < lastpos) {
+        changed |= hb_reset_elem(&elems[pos], start,
+                                 start | (BITS_PER_LONG - 1));
 
-        /* Here we need a more complex test than when setting bits.  Even if
-         * something was changed, we must not blank bits in the upper level
-         * unless the lower-level word became entirely zero.  So, remove pos
-         * from the upper-level range if bits remain set.
-         */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        /* The words in between are cleared entirely.  */
+        if (hb_find_word(elems, pos + 1, lastpos, 0, false) < lastpos) {
             changed = true;
-        } else {
-            pos++;
-        }
-
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
         }
+        memset(&elems[pos + 1], 0, (lastpos - pos - 1) * sizeof(*elems));
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
+    changed |= hb_reset_elem(&elems[lastpos], start, last);
+    return changed;
+}
 
-    /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
-        changed = true;
-    } else {
+static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
+                             uint64_t last);
+
+/* Words pos..lastpos of the given level were cleared, entirely except
+ * possibly for the first and the last.  Update the layer above.
+ */
+static void hb_reset_upper(HBitmap *hb, int level, size_t pos, size_t lastpos)
+{
+    /* Here we need a more complex test than when setting bits.  Even if
+     * something was changed, we must not blank bits in the upper level
+     * unless the lower-level word became entirely zero.  So, remove pos
+     * and lastpos from the upper-level range if bits remain set.
+     */
+    if (hb_word(hb, level, pos)) {
+        pos++;
+    }
+    if (pos <= lastpos && hb_word(hb, level, lastpos)) {
         lastpos--;
     }
-
-    if (level > 0 && changed) {
+    if (pos <= lastpos) {
         hb_reset_between(hb, level - 1, pos, lastpos);
     }
+}
+
+/* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
+ * Returns true if at least one bit is changed. */
+static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
+                             uint64_t last)
+{
+    bool changed = hb_reset_words(hb->levels[level], start, last);
 
+    if (level > 0 && changed) {
+        hb_reset_upper(hb, level, start >> BITS_PER_LEVEL,
+                       last >> BITS_PER_LEVEL);
+    }
     return changed;
+}
+
+/* Same as hb_reset_between, for the last layer.  */
+static bool hb_reset_last(HBitmap *hb, uint64_t start, uint64_t last)
+{
+    size_t c = start >> HB_CHUNK_BITS_SHIFT;
+    size_t lastc = last >> HB_CHUNK_BITS_SHIFT;
+    bool changed = false;
 
+    for (; c <= lastc; c++) {
+        uint64_t base = (uint64_t)c << HB_CHUNK_BITS_SHIFT;
+        uint64_t first_bit = MAX(start, base) - base;
+        uint64_t last_bit = MIN(last - base, HB_CHUNK_BITS - 1);
+        unsigned long *chunk = hb->chunks[c];
+
+        if (!chunk) {
+            continue;
+        }
+        if (hb->sparse && first_bit == 0 && last_bit == HB_CHUNK_BITS - 1) {
+            changed |= chunk == HB_ONES ||
+                hb_find_word(chunk, 0, HB_CHUNK_WORDS, 0, false) <
+                    HB_CHUNK_WORDS;
+            hb_chunk_fill(hb, c, false);
+            continue;
+        }
+
+        if (hb_reset_words(hb_chunk_writable(hb, c), first_bit, last_bit)) {
+            changed = true;
+            hb_chunk_compact(hb, c);
+        }
+    }
+
+    if (changed) {
+        hb_reset_upper(hb, HBITMAP_LEVELS - 1, start >> BITS_PER_LEVEL,
+                       last >> BITS_PER_LEVEL);
+    }
+    return changed;
 }
 
 void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
@@ -577,8 +966,7 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     assert(last < hb->size);
 
     hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
+    if (hb_reset_last(hb, first, last) && hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
 }
@@ -586,9 +974,13 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
 void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
+    size_t c;
 
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    for (c = 0; c < hb->nr_chunks; c++) {
+        hb_chunk_fill(hb, c, false);
+    }
+    for (i = HBITMAP_LEVELS - 1; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -621,7 +1013,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_last_word(hb, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -638,7 +1030,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -652,20 +1044,44 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
+/* Fill words pos..pos+count-1 of the last level with zeroes or ones,
+ * without updating the layers above.
+ */
+static void hb_last_fill(HBitmap *hb, uint64_t pos, uint64_t count, bool ones)
+{
+    uint64_t end = pos + count;
+
+    while (pos < end) {
+        size_t c = pos >> HB_CHUNK_SHIFT;
+        uint64_t base = (uint64_t)c << HB_CHUNK_SHIFT;
+        uint64_t chunk_end = MIN(end - base, HB_CHUNK_WORDS);
+        unsigned long *chunk = hb->chunks[c];
+
+        if (pos == base && chunk_end == HB_CHUNK_WORDS &&
+            (!ones || ((uint64_t)(c + 1) << HB_CHUNK_BITS_SHIFT) <= hb->size)) {
+            hb_chunk_fill(hb, c, ones);
+        } else if (chunk != (ones ? HB_ONES : NULL)) {
+            memset(hb_chunk_writable(hb, c) + (pos - base), ones ? 0xff : 0,
+                   (chunk_end - (pos - base)) * sizeof(unsigned long));
+        }
+        pos = base + chunk_end;
+    }
+}
+
 uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur;
+    uint64_t pos;
 
     if (!count) {
         return 0;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
+    serialization_chunk(hb, start, count, &pos, &el_count);
 
     return el_count * sizeof(unsigned long);
 }
@@ -674,21 +1090,19 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t pos;
 
     if (!count) {
         return;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
-    end = cur + el_count;
+    serialization_chunk(hb, start, count, &pos, &el_count);
 
-    while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+    while (el_count--) {
+        unsigned long el = hb_last_word(hb, pos++);
 
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
-        cur++;
     }
 }
 
@@ -697,25 +1111,25 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t pos;
 
     if (!count) {
         return;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
-    end = cur + el_count;
+    serialization_chunk(hb, start, count, &pos, &el_count);
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    for (; el_count--; pos++) {
+        unsigned long el;
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+        memcpy(&el, buf, sizeof(el));
+        el = (BITS_PER_LONG == 32 ? le32_to_cpu(el) : le64_to_cpu(el));
 
+        /* Do not allocate chunks needlessly.  */
+        if (hb_last_word(hb, pos) != el) {
+            hb_chunk_writable(hb, pos >> HB_CHUNK_SHIFT)
+                [pos & (HB_CHUNK_WORDS - 1)] = el;
+        }
         buf += sizeof(unsigned long);
-        cur++;
     }
     if (finish) {
         hbitmap_deserialize_finish(hb);
@@ -726,14 +1140,14 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_last_fill(hb, first, el_count, false);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -743,14 +1157,14 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_last_fill(hb, first, el_count, true);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -759,8 +1173,13 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
 void hbitmap_deserialize_finish(HBitmap *bitmap)
 {
     int64_t i, size, prev_size;
+    size_t c;
     int lev;
 
+    for (c = 0; c < bitmap->nr_chunks; c++) {
+        hb_chunk_compact(bitmap, c);
+    }
+
     /* restore levels starting from penultimate to zero level, assuming
      * that the last level is ok */
     size = MAX((bitmap->size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
@@ -770,7 +1189,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
         for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
+            if (hb_word(bitmap, lev + 1, i)) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
                     1UL << (i & (BITS_PER_LONG - 1));
             }
@@ -778,14 +1197,40 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
-    bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    bitmap->count = hb_count_all(bitmap);
+}
+
+/* Resize chunks[] to cover the last level.  */
+static void hb_resize_chunks(HBitmap *hb)
+{
+    size_t nr_chunks = DIV_ROUND_UP(hb->sizes[HBITMAP_LEVELS - 1],
+                                    HB_CHUNK_WORDS);
+    size_t c;
+
+    for (c = nr_chunks; c < hb->nr_chunks; c++) {
+        if (hb->chunks[c] != HB_ONES) {
+            g_free(hb->chunks[c]);
+        }
+    }
+    hb->chunks = g_renew(unsigned long *, hb->chunks, nr_chunks);
+    for (c = hb->nr_chunks; c < nr_chunks; c++) {
+        hb->chunks[c] = NULL;
+    }
+    hb->nr_chunks = nr_chunks;
 }
 
 void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
+    size_t c;
     assert(!hb->meta);
-    for (i = HBITMAP_LEVELS; i-- > 0; ) {
+    for (c = 0; c < hb->nr_chunks; c++) {
+        if (hb->chunks[c] != HB_ONES) {
+            g_free(hb->chunks[c]);
+        }
+    }
+    g_free(hb->chunks);
+    for (i = HBITMAP_LEVELS - 1; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
     g_free(hb);
@@ -808,8 +1253,11 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (i < HBITMAP_LEVELS - 1) {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
+    hb_resize_chunks(hb);
 
     /* We necessarily have free bits in level 0 due to the definition
      * of HBITMAP_LEVELS, so use one for a sentinel.  This speeds up
@@ -820,6 +1268,48 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     return hb;
 }
 
+HBitmap *hbitmap_copy(const HBitmap *hb)
+{
+    HBitmap *copy = hbitmap_alloc(hb->orig_size, hb->granularity);
+    unsigned i;
+    size_t c;
+
+    for (i = 0; i < HBITMAP_LEVELS - 1; i++) {
+        memcpy(copy->levels[i], hb->levels[i],
+               hb->sizes[i] * sizeof(unsigned long));
+    }
+    for (c = 0; c < hb->nr_chunks; c++) {
+        if (hb->chunks[c] && hb->chunks[c] != HB_ONES) {
+            copy->chunks[c] = g_memdup2(hb->chunks[c],
+                                        HB_CHUNK_WORDS * sizeof(unsigned long));
+        } else {
+            copy->chunks[c] = hb->chunks[c];
+        }
+    }
+    copy->count = hb->count;
+    copy->sparse = hb->sparse;
+    return copy;
+}
+
+bool hbitmap_is_sparse(const HBitmap *hb)
+{
+    return hb->sparse;
+}
+
+void hbitmap_set_sparse(HBitmap *hb, bool sparse)
+{
+    size_t c;
+
+    hb->sparse = sparse;
+    for (c = 0; c < hb->nr_chunks; c++) {
+        if (sparse) {
+            hb_chunk_compact(hb, c);
+        } else if (hb->chunks[c] == HB_ONES) {
+            hb_chunk_writable(hb, c);
+        }
+    }
+}
+
 void hbitmap_truncate(HBitmap *hb, uint64_t size)
 {
     bool shrink;
@@ -862,6 +1352,11 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
+        if (i == HBITMAP_LEVELS - 1) {
+            /* New chunks are empty, and the old ones were cleared above.  */
+            hb_resize_chunks(hb);
+            continue;
+        }
         hb->levels[i] = g_renew(unsigned long, hb->levels[i], size);
         if (!shrink) {
             memset(&hb->levels[i][old], 0x00,
@@ -892,6 +1387,39 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/* Merge chunk c of a and b into result.  */
+static void hb_merge_chunk(const HBitmap *a, const HBitmap *b,
+                           HBitmap *result, size_t c)
+{
+    const unsigned long *ca = a->chunks[c];
+    const unsigned long *cb = b->chunks[c];
+    const unsigned long *src;
+    unsigned long *cr;
+    size_t j;
+
+    if (ca == HB_ONES || cb == HB_ONES) {
+        hb_chunk_fill(result, c, true);
+        return;
+    }
+    if (!ca || !cb) {
+        /* Only one of them (or none) has bits set; copy it.  */
+        src = ca ? ca : cb;
+        if (!src) {
+            hb_chunk_fill(result, c, false);
+        } else if (src != result->chunks[c]) {
+            memcpy(hb_chunk_writable(result, c), src,
+                   HB_CHUNK_WORDS * sizeof(unsigned long));
+        }
+        return;
+    }
+
+    cr = hb_chunk_writable(result, c);
+    for (j = 0; j < HB_CHUNK_WORDS; j++) {
+        cr[j] = ca[j] | cb[j];
+    }
+    hb_chunk_compact(result, c);
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -902,6 +1430,7 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
     uint64_t j;
+    size_t c;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -934,22 +1463,36 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (c = 0; c < a->nr_chunks; c++) {
+        hb_merge_chunk(a, b, result, c);
+    }
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
 
     /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    result->count = hb_count_all(result);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
 {
-    size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
-    char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
+    uint64_t words = bitmap->sizes[HBITMAP_LEVELS - 1];
+    g_autofree struct iovec *iov = g_new(struct iovec, bitmap->nr_chunks);
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALG_SHA256, data, size, &hash, errp);
+    size_t c;
+
+    for (c = 0; c < bitmap->nr_chunks; c++) {
+        const unsigned long *chunk = bitmap->chunks[c];
+        uint64_t base = (uint64_t)c << HB_CHUNK_SHIFT;
+
+        iov[c].iov_base = (void *)(chunk ? chunk : hb_zero_chunk);
+        iov[c].iov_len = MIN(words - base, HB_CHUNK_WORDS) *
+                         sizeof(unsigned long);
+    }
+    qcrypto_hash_digestv(QCRYPTO_HASH_ALG_SHA256, iov, bitmap->nr_chunks,
+                         &hash, errp);
 
     return hash;
 }
@@ -23,6 +23,7 @@
 
 enum {
     COROUTINE_POOL_BATCH_MAX_SIZE = 128,
+    COROUTINE_POOL_NODES = 8,
 };
 
 /*
@@ -33,17 +34,27 @@ enum {
  *
  * The pool is global but each thread maintains a small local pool to avoid
  * global pool contention. Threads fetch and return batches of coroutines from
- * the global pool to maintain their local pool. The local pool holds up to two
- * batches whereas the maximum size of the global pool is controlled by the
- * qemu_coroutine_inc_pool_size() API.
+ * the global pool to maintain their local pool. A full batch is returned to
+ * the global pool if the local pool holds another one, whereas the maximum
+ * size of the global pool is controlled by the qemu_coroutine_inc_pool_size()
+ * API.
+ *
+ * The global pool is a set of lock-free stacks of batches, one per host NUMA
+ * node (modulo COROUTINE_POOL_NODES). Batches are pushed one at a time, but a
+ * thread whose local pool is empty takes all batches of a stack at once. A
+ * coroutine's stack pages are allocated on the node where they are first
+ * touched, i.e. where the coroutine first ran, so threads return batches to
+ * the stack of the node they run on and take batches from it first. Other
+ * nodes are only tried when it is empty, since a remote stack is still
+ * cheaper than a new one.
  *
  * .-----------------------------------.
- * | Batch 1 | Batch 2 | Batch 3 | ... | global_pool
+ * | Batch 1 | Batch 2 | Batch 3 | ... | global_pools[node]
  * `-----------------------------------'
  *
- * .-------------------.
- * | Batch 1 | Batch 2 | per-thread local_pool (maximum 2 batches)
- * `-------------------'
+ * .-------------------------.
+ * | Batch 1 | Batch 2 | ... | per-thread local_pool
+ * `-------------------------'
  */
 typedef struct CoroutinePoolBatch {
     /* Batches are kept in a list */
@@ -59,8 +70,9 @@ typedef QSLIST_HEAD(, CoroutinePoolBatch) CoroutinePool;
 /* Host operating system limit on number of pooled coroutines */
 static unsigned int global_pool_hard_max_size;
 
-static QemuMutex global_pool_lock; /* protects the following variables */
-static CoroutinePool global_pool = QSLIST_HEAD_INITIALIZER(global_pool);
+static CoroutinePool global_pools[COROUTINE_POOL_NODES];
+
+/* Accessed atomically; global_pool_size counts the batches of all nodes */
 static unsigned int global_pool_size;
 static unsigned int global_pool_max_size = COROUTINE_POOL_BATCH_MAX_SIZE;
 
@@ -132,42 +144,78 @@ static Coroutine *coroutine_pool_get_local(void)
     return co;
 }
 
-/* Get the next batch from the global pool */
-static void coroutine_pool_refill_local(void)
+/* Return the index in global_pools[] for the NUMA node of the current CPU */
+static unsigned int coroutine_pool_node(void)
+{
+#ifdef CONFIG_GETCPU
+    unsigned int cpu, node;
+
+    if (getcpu(&cpu, &node) == 0) {
+        return node % COROUTINE_POOL_NODES;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Move all batches of @pool to the local pool and return true, or return
+ * false if @pool is empty. Popping a single element off a lock-free stack
+ * suffers from the ABA problem: the head could be popped and pushed back,
+ * with a different successor, between reading its successor and the
+ * compare-and-swap. Taking the whole stack with one atomic exchange, and
+ * keeping it, cannot run into that.
+ */
+static bool coroutine_pool_take(CoroutinePool *pool)
 {
     CoroutinePool *local_pool = get_ptr_local_pool();
+    CoroutinePool list;
     CoroutinePoolBatch *batch;
 
-    WITH_QEMU_LOCK_GUARD(&global_pool_lock) {
-        batch = QSLIST_FIRST(&global_pool);
+    if (!qatomic_read(&pool->slh_first)) {
+        return false;
+    }
 
-        if (batch) {
-            QSLIST_REMOVE_HEAD(&global_pool, next);
-            global_pool_size -= batch->size;
-        }
+    QSLIST_MOVE_ATOMIC(&list, pool);
+    if (QSLIST_EMPTY(&list)) {
+        return false;
     }
 
-    if (batch) {
+    while ((batch = QSLIST_FIRST(&list))) {
+        QSLIST_REMOVE_HEAD(&list, next);
+        qatomic_sub(&global_pool_size, batch->size);
         QSLIST_INSERT_HEAD(local_pool, batch, next);
-        local_pool_cleanup_init_once();
     }
+    local_pool_cleanup_init_once();
+    return true;
 }
 
-/* Add a batch of coroutines to the global pool */
-static void coroutine_pool_put_global(CoroutinePoolBatch *batch)
+/* Refill the local pool from the global pool, preferring the local node */
+static void coroutine_pool_refill_local(void)
 {
-    WITH_QEMU_LOCK_GUARD(&global_pool_lock) {
-        unsigned int max = MIN(global_pool_max_size,
-                               global_pool_hard_max_size);
-
-        if (global_pool_size < max) {
-            QSLIST_INSERT_HEAD(&global_pool, batch, next);
+    unsigned int node = coroutine_pool_node();
+    unsigned int i;
 
-            /* Overshooting the max pool size is allowed */
-            global_pool_size += batch->size;
+    for (i = 0; i < COROUTINE_POOL_NODES; i++) {
+        if (coroutine_pool_take(
+                &global_pools[(node + i) % COROUTINE_POOL_NODES])) {
             return;
         }
     }
+}
+
+/* Add a batch of coroutines to the global pool */
+static void coroutine_pool_put_global(CoroutinePoolBatch *batch)
+{
+    unsigned int max = MIN(qatomic_read(&global_pool_max_size),
+                           global_pool_hard_max_size);
+
+    if (qatomic_read(&global_pool_size) < max) {
+        /* Overshooting the max pool size is allowed */
+        qatomic_add(&global_pool_size, batch->size);
+        QSLIST_INSERT_HEAD_ATOMIC(&global_pools[coroutine_pool_node()],
+                                  batch, next);
+        return;
+    }
 
     /* The global pool was full, so throw away this batch */
     coroutine_pool_batch_delete(batch);
@@ -351,14 +399,12 @@ AioContext *qemu_coroutine_get_aio_context(Coroutine *co)
 
 void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size)
 {
-    QEMU_LOCK_GUARD(&global_pool_lock);
-    global_pool_max_size += additional_pool_size;
+    qatomic_add(&global_pool_max_size, additional_pool_size);
 }
 
 void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
-    QEMU_LOCK_GUARD(&global_pool_lock);
-    global_pool_max_size -= removing_pool_size;
+    qatomic_sub(&global_pool_max_size, removing_pool_size);
 }
 
 static unsigned int get_global_pool_hard_max_size(void)
@@ -396,6 +442,5 @@ static unsigned int get_global_pool_hard_max_size(void)
 
 static void __attribute__((constructor)) qemu_coroutine_init(void)
 {
-    qemu_mutex_init(&global_pool_lock);
     global_pool_hard_max_size = get_global_pool_hard_max_size();
 }